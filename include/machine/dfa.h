@@ -7,7 +7,9 @@
 #include "regex.h"
 #include <cstddef>
 #include <cstdint>
+#include <optional>
 #include <ostream>
+#include <span>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -25,16 +27,90 @@ namespace lexergen
         std::size_t case_count;
     };
 
+    struct codegen_options
+    {
+        target_lang lang = target_lang::CPP;
+        std::string_view fn_name;
+        bool emit_prelude = true;
+        bool enable_simd = false;
+        bool sentinel = false;
+        // (cpp target) count lines in the raw-cursor scanner and keep them in the Source; handlers get start_line/start_column
+        bool track_lines = false;
+        // (cpp/c targets) also emit a batch entry point under this name; empty emits none
+        std::string_view batch_fn_name;
+        // every TOKEN kind in the grammar, in enum order; the prelude declares the token enum/struct when non-empty
+        std::span<const std::string> token_kinds;
+        // (codegen_states) handlers switch STATE with BEGIN/PUSH/POP, so lex_tok takes a lex_states& instead of a lex_state_id
+        bool state_actions = false;
+        // (cpp target) also emit a multi-threaded entry point over batch_fn_name under this name; empty emits none
+        std::string_view parallel_fn_name;
+        // (cpp target) also emit an incremental re-lexing entry point under this name (and its scanner as <name>_scan); empty emits none
+        std::string_view incremental_fn_name;
+        // (cpp target) also emit a push-mode entry point under this name, running handle_need_more when a chunk runs out mid-token
+        std::string_view push_fn_name;
+        std::string_view handle_need_more;
+        // (cpp target) also emit a coroutine token stream over push_fn_name under this name
+        std::string_view stream_fn_name;
+        // (cpp target) lex_tok takes a lexgen_linear::memo of failed (state, position) pairs, which bounds rescanning to O(n) overall
+        bool linear = false;
+    };
+
+    // One STATE block of a grammar whose handlers switch STATEs with BEGIN/PUSH/POP; the top level is named INITIAL
+    struct state_machine
+    {
+        std::string name;
+        const dfa* machine;
+        std::string handle_error;
+        std::string handle_internal_error;
+    };
+
+    // Where the token of a `/r/s/` rule ends, found when the DFA accepts at the end of s
+    struct trailing_cut
+    {
+        enum class kind : uint8_t
+        {
+            TAIL, // s always has `length` bytes: that far back from the cursor
+            HEAD, // r always has `length` bytes: that far on from the token start
+            MARK, // neither: the cursor when the scan last entered a state where r can end (dfa::trail_marks)
+        };
+
+        kind cut;
+        int64_t length = 0;
+    };
+
     struct dfa_warning
     {
         int64_t state;
         std::string detail;
     };
 
+    // How far a scan can read past an accept in `state` (into states that don't accept) before it fails and backtracks to it
+    struct rescan_bound
+    {
+        int64_t state;
+        // the rule accepted there, by index in the table passed to make_lexer
+        int64_t rule;
+        // none: without bound, through a loop
+        std::optional<int64_t> max_bytes;
+    };
+
+    // A rule pair that makes lexing quadratic: on `period` repeated, each `accepted_rule` token (ending in `state`) is only found after the
+    // scan for `pursued_rule` (-1 if none can match) reads on to the end of the input and backtracks, and such tokens keep coming
+    struct quadratic_backtrack
+    {
+        int64_t state;
+        int64_t accepted_rule;
+        int64_t pursued_rule;
+        std::string period;
+    };
+
     struct dfa_warnings
     {
         std::vector<dfa_warning> unmatchable;
         std::vector<dfa_warning> past_the_end;
+        // filled by check_backtrack: one bound per accepting state, and each rule pair whose unbounded rescans recur token after token
+        std::vector<rescan_bound> rescan_bounds;
+        std::vector<quadratic_backtrack> quadratic;
     };
 
     class dfa
@@ -47,6 +123,17 @@ namespace lexergen
         std::vector<bool> end_bitmask;
         std::vector<int64_t> end_to_nfa_state;
         std::unordered_map<int64_t, std::string> handler_map;
+        // accepting NFA state -> index of its rule in the table passed to make_lexer
+        std::unordered_map<int64_t, int64_t> rule_ids;
+        std::unordered_set<int64_t> batch_handlers;
+        // accepting NFA state -> token kind, for TOKEN rules
+        std::unordered_map<int64_t, int64_t> token_rules;
+        // accepting NFA state -> how to find the end of its token, for `/r/s/` rules
+        std::unordered_map<int64_t, trailing_cut> trailing_rules;
+        // per state, the MARK rules (by accepting NFA state) whose r can end on entering it; empty if the DFA has none
+        std::vector<std::vector<int64_t>> trail_marks;
+        // MARK rules (by index in the table) where some input also matches r past the true end of r, so the last mark can be wrong
+        std::vector<int64_t> ambiguous_trailing;
         equivalence_classes classes;
 
         dfa(int64_t states, equivalence_classes classes)
@@ -58,17 +145,28 @@ namespace lexergen
         auto source_states(int64_t class_id, const state_set& target) -> state_set;
         auto hopcroft(const std::unordered_set<state_set>& initial) -> std::vector<state_set>;
         void reconstruct(const std::vector<state_set>& partitions);
+        void analyze_backtrack(dfa_warnings& result) const;
 
     public:
         void optimize(bool debug);
 
         auto codegen(
-            std::ostream& out, const std::string& inc, const std::string& handle_error, const std::string& handle_internal_error, target_lang lang,
-            std::string_view fn_name = "", bool emit_prelude = true, bool enable_simd = false
+            std::ostream& out, const std::string& inc, const std::string& handle_error, const std::string& handle_internal_error,
+            const codegen_options& options
         ) const -> codegen_result;
+        // (cpp target) every STATE in one function sharing a FAIL tail and, for byte-level DFAs, a class table: lex_tok(src, ctx, state)
+        // taking the lex_state_id to lex in, or with options.state_actions lex_tok(src, ctx, lex_state) following BEGIN/PUSH/POP
+        static auto codegen_states(
+            std::ostream& out, const std::string& inc, std::span<const state_machine> states, const codegen_options& options
+        ) -> codegen_result;
         void dump(std::ostream& ofs) const;
         void dump_cluster(std::ostream& ofs, int64_t node_offset, std::string_view label) const;
-        auto analyze_warnings(bool check_unmatchable, bool check_past_end) const -> dfa_warnings;
+        auto analyze_warnings(bool check_unmatchable, bool check_past_end, bool check_backtrack = false) const -> dfa_warnings;
+        // why lexing can't safely restart at an arbitrary newline, if it can't
+        auto find_newline_desync() const -> std::optional<dfa_warning>;
+        // the states --linear memoizes: non-accepting ones that can loop after an accept, and so rescan without bound when the scan
+        // fails; empty if every rescan is bounded
+        auto linear_memo_states() const -> std::vector<int64_t>;
 
         constexpr auto get_transition_table() const -> const auto& { return transition_table; }
         constexpr auto get_start_state() const -> const auto& { return start_state; }
@@ -77,6 +175,8 @@ namespace lexergen
         constexpr auto get_state_count() const -> auto { return static_cast<int64_t>(end_bitmask.size()); }
         auto get_class_count() const -> auto { return classes.class_count(); }
         auto get_classes() const -> const auto& { return classes; }
+        auto has_trailing_context() const -> bool { return !trailing_rules.empty(); }
+        auto get_ambiguous_trailing() const -> const auto& { return ambiguous_trailing; }
     };
 
     void dump_all(std::ostream& ofs, const std::vector<std::pair<std::string, const dfa*>>& entries);
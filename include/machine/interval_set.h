@@ -14,6 +14,7 @@ namespace lexergen
     {
     public:
         using codepoint = std::uint32_t;
+        static constexpr codepoint MAX_CODEPOINT = 0x10FFFF;
 
         struct interval
         {
@@ -95,6 +96,7 @@ namespace lexergen
             return lhs;
         }
 
+        // byte-level negation; see complement() for codepoint sets
         [[nodiscard]] auto operator~() const -> interval_set
         {
             constexpr codepoint BYTE_MAX_CP = 0xFF;
@@ -107,19 +109,29 @@ namespace lexergen
                 }
             }
 
+            return complement(BYTE_MAX_CP);
+        }
+
+        // everything in [0, max] that isn't in this set
+        [[nodiscard]] auto complement(codepoint max) const -> interval_set
+        {
             interval_set result;
             codepoint next = 0;
             for (const auto& interval : intervals)
             {
+                if (interval.lo > max)
+                {
+                    break;
+                }
                 if (interval.lo > next)
                 {
                     result.intervals.push_back({.lo = next, .hi = interval.lo - 1});
                 }
                 next = interval.hi + 1;
             }
-            if (next <= BYTE_MAX_CP)
+            if (next <= max)
             {
-                result.intervals.push_back({.lo = next, .hi = BYTE_MAX_CP});
+                result.intervals.push_back({.lo = next, .hi = max});
             }
             return result;
         }
@@ -30,6 +30,8 @@ namespace lexergen
         std::vector<std::pair<int64_t, int64_t>> epsilon_edges;
         std::vector<int64_t> start;
         std::vector<end_entry> end;
+        // (node, end): a DFA state containing `node` records the cursor for the trailing context rule accepting at `end`
+        std::vector<std::pair<int64_t, int64_t>> trail_marks;
         int64_t max_val = 0;
         equivalence_classes classes;
 
@@ -65,8 +67,18 @@ namespace lexergen
             return *this;
         }
 
+        auto add_trail_mark(int64_t node, int64_t end_node) -> nfa_builder&
+        {
+            trail_marks.emplace_back(node, end_node);
+            return *this;
+        }
+
         [[nodiscard]] auto get_classes() const -> const equivalence_classes& { return classes; }
 
+        // whether a string reaching `r_end` from `r_start` can carry on (through the epsilon edge to `s_start`) into a non-empty prefix of
+        // a match of s ending at `s_end`, and reach `r_end` again along the way: then the end of r isn't the last place r matched
+        [[nodiscard]] auto trailing_ambiguous(int64_t r_start, int64_t r_end, int64_t s_start, int64_t s_end) const -> bool;
+
         auto build() -> dfa;
         void dump(std::ostream& ofs) const;
         void dump_cluster(std::ostream& ofs, int64_t node_offset, std::string_view label) const;
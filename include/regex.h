@@ -4,6 +4,7 @@
 #include "machine/interval_set.h"
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -23,6 +24,14 @@ namespace lexergen
 
             virtual void collect_charsets(std::vector<interval_set>& out) const { (void)out; }
 
+            // the number of bytes every match consumes, if it's the same for all of them; `byte_level` says the DFA reads bytes, else
+            // it decodes codepoints and only ASCII is known to be one byte
+            [[nodiscard]] virtual auto fixed_length(bool byte_level) const -> std::optional<int64_t>
+            {
+                (void)byte_level;
+                return std::nullopt;
+            }
+
             virtual ~regex_element() = default;
         };
     } // namespace detail
@@ -31,22 +40,35 @@ namespace lexergen
     using regex = std::shared_ptr<detail::regex_element>;
     using macro_table = std::unordered_map<std::string, regex>;
 
+    struct regex_options
+    {
+        // charsets are sets of codepoints, compiled to the bytes of their UTF-8 encodings (see utf8_regex)
+        bool utf8 = false;
+    };
+
     struct rule_def
     {
         regex expr;
         std::string handler;
         int64_t priority = 0;
+        // trailing context of `/r/s/`: must follow `expr` for the rule to match, but is left in the input; null if none
+        regex trailing;
+        // lex_batch runs the handler for this rule instead of storing its token (e.g. skipping whitespace)
+        bool batch_handler = false;
+        // TOKEN rule: index of its kind in the grammar's token kind list; the handler is generated, not user code
+        int64_t token_kind = -1;
     };
 
     struct regex_parse_result
     {
         bool is_success;
         regex expr;
+        regex trailing;
         std::string error_msg;
         std::string rest;
     };
 
-    auto parse_regex(const std::string& str, const macro_table& macros) -> regex_parse_result;
+    auto parse_regex(const std::string& str, const macro_table& macros, const regex_options& options = {}) -> regex_parse_result;
 
     auto character(char ch) -> char_set;
     auto character_range(char ch_from, char ch_to) -> char_set;
@@ -58,10 +80,12 @@ namespace lexergen
     auto xdigit() -> char_set;
     auto unicode_xid_start() -> char_set;
     auto unicode_xid_continue() -> char_set;
+    auto utf8_encode(char_set::codepoint cp) -> std::string;
 
-    auto builtin_macros() -> macro_table;
+    auto builtin_macros(const regex_options& options = {}) -> macro_table;
 
     auto char_regex(char_set charset) -> regex;
+    auto utf8_regex(const char_set& charset) -> regex;
     auto string_regex(std::string str) -> regex;
     auto star_regex(const regex& regexp) -> regex;
     auto operator+(const regex& lhs, const regex& rhs) -> regex;
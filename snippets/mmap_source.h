@@ -0,0 +1,163 @@
+/* O_CLOEXEC, MAP_ANONYMOUS and madvise() are hidden by strict ISO C (-std=c11) unless _DEFAULT_SOURCE is defined before the first
+ * system header. Generated C includes <stdint.h> ahead of the preamble, so build it with -D_DEFAULT_SOURCE (or -std=gnu11). */
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if !defined(O_CLOEXEC) || !defined(MAP_ANONYMOUS)
+#error "mmap_source.h needs _DEFAULT_SOURCE before any system header: build with -D_DEFAULT_SOURCE or -std=gnu11"
+#endif
+
+#define SOURCE_PADDING 64
+
+typedef struct
+{
+    void* map;
+    size_t map_len;
+
+    const char* base;
+    const char* cur;
+    const char* la;
+    const char* end;
+    const char* tok_start;
+
+    size_t bytes;
+    size_t la_bytes;
+} Source;
+
+/* maps path read-only over zeroed pages, so *end is '\0' followed by SOURCE_PADDING readable bytes; returns -1 and sets errno on failure */
+static int Source_open(Source* s, const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t map_len = (size + 1 + SOURCE_PADDING + page - 1) / page * page;
+
+    void* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED || (size > 0 && mmap(map, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
+    {
+        int err = errno;
+        if (map != MAP_FAILED)
+        {
+            munmap(map, map_len);
+        }
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    close(fd);
+
+    /* advice only: the lexer reads front to back once */
+    madvise(map, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, size, MADV_HUGEPAGE);
+#endif
+
+    s->map = map;
+    s->map_len = map_len;
+    s->base = (const char*)map;
+    s->cur = s->base;
+    s->la = s->base;
+    s->end = s->base + size;
+    s->tok_start = s->base;
+    s->bytes = 0;
+    s->la_bytes = 0;
+    return 0;
+}
+
+static void Source_close(Source* s)
+{
+    munmap(s->map, s->map_len);
+    s->map = NULL;
+}
+
+static int Source_peek(Source* s)
+{
+    if (s->la >= s->end)
+    {
+        return 0;
+    }
+
+    unsigned char ch = (unsigned char)*s->la++;
+    s->la_bytes++;
+
+    return ch;
+}
+
+static void Source_accept(Source* s)
+{
+    s->cur = s->la;
+    s->bytes = s->la_bytes;
+}
+
+static void Source_backtrack(Source* s)
+{
+    s->la = s->cur;
+    s->la_bytes = s->bytes;
+}
+
+static void Source_start_token(Source* s) { s->tok_start = s->cur; }
+
+static lex_text Source_text(const Source* s)
+{
+    lex_text t;
+    t.ptr = s->tok_start;
+    t.len = (size_t)(s->cur - s->tok_start);
+    return t;
+}
+
+static size_t Source_bytes(const Source* s) { return s->bytes; }
+
+static lex_text Source_remaining(const Source* s)
+{
+    lex_text t;
+    t.ptr = s->la;
+    t.len = (size_t)(s->end - s->la);
+    return t;
+}
+
+static void Source_skip(Source* s, size_t n)
+{
+    s->la += n;
+    s->la_bytes += n;
+}
+
+/* lets --simd output detect the bulk-scan hooks */
+#define Source_remaining Source_remaining
+#define Source_skip Source_skip
+
+static const char* Source_begin(const Source* s) { return s->base; }
+
+static const char* Source_cursor(const Source* s) { return s->cur; }
+
+static const char* Source_end(const Source* s) { return s->end; }
+
+static void Source_commit(Source* s, const char* token_start, const char* token_end)
+{
+    s->tok_start = token_start;
+    s->cur = s->la = token_end;
+    s->bytes = s->la_bytes = (size_t)(token_end - s->base);
+}
@@ -0,0 +1,156 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Maps a file read-only instead of reading it into memory. The mapping sits at the start of a reservation of zeroed pages, so the file
+// is followed by a NUL and at least `padding` more zero bytes: it works with --sentinel output as-is, without copying.
+class mmap_source
+{
+    void* map = nullptr;
+    std::size_t map_len = 0;
+
+    const char* base;
+    const char* cur;
+    const char* la;
+    const char* end_;
+    const char* tok_start = nullptr;
+
+    std::size_t bytes_ = 0;
+    std::size_t la_bytes_ = 0;
+
+    // for --track-lines output
+    std::size_t line_ = 1;
+    std::size_t line_start_ = 0;
+
+public:
+    static constexpr std::size_t padding = 64;
+
+    explicit mmap_source(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        }
+
+        struct stat st{};
+        if (::fstat(fd, &st) == -1)
+        {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "fstat " + path);
+        }
+
+        const auto size = static_cast<std::size_t>(st.st_size);
+        const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        map_len = (size + 1 + padding + page - 1) / page * page;
+
+        // zero pages for the sentinel and padding, with the file mapped over their start (the tail of its last page reads as zero too)
+        map = ::mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map != MAP_FAILED && size > 0 && ::mmap(map, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            int err = errno;
+            ::munmap(map, map_len);
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "mmap " + path);
+        }
+        ::close(fd);
+        if (map == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::generic_category(), "mmap " + path);
+        }
+
+        // advice only: the lexer reads front to back once
+        ::madvise(map, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        ::madvise(map, size, MADV_HUGEPAGE);
+#endif
+
+        base = cur = la = static_cast<const char*>(map);
+        end_ = base + size;
+    }
+
+    mmap_source(const mmap_source&) = delete;
+    auto operator=(const mmap_source&) -> mmap_source& = delete;
+
+    ~mmap_source()
+    {
+        if (map != nullptr)
+        {
+            ::munmap(map, map_len);
+        }
+    }
+
+    // the whole file, e.g. for lex_parallel
+    [[nodiscard]] auto data() const -> std::string_view { return {base, static_cast<std::size_t>(end_ - base)}; }
+
+    auto peek() -> std::uint8_t
+    {
+        if (la >= end_)
+        {
+            return 0;
+        }
+
+        char ch = *la++;
+        la_bytes_++;
+
+        return static_cast<std::uint8_t>(ch);
+    }
+
+    void accept()
+    {
+        cur = la;
+        bytes_ = la_bytes_;
+    }
+
+    void backtrack()
+    {
+        la = cur;
+        la_bytes_ = bytes_;
+    }
+
+    void start_token() { tok_start = cur; }
+
+    [[nodiscard]] auto text() const -> std::string_view { return {tok_start, cur}; }
+
+    [[nodiscard]] auto bytes() const -> std::size_t { return bytes_; }
+
+    [[nodiscard]] auto remaining() const -> std::string_view { return {la, static_cast<std::size_t>(end_ - la)}; }
+
+    void skip(std::size_t n)
+    {
+        la += n;
+        la_bytes_ += n;
+    }
+
+    [[nodiscard]] auto begin() const -> const char* { return base; }
+
+    [[nodiscard]] auto cursor() const -> const char* { return cur; }
+
+    [[nodiscard]] auto end() const -> const char* { return end_; }
+
+    void commit(const char* token_start, const char* token_end)
+    {
+        tok_start = token_start;
+        cur = la = token_end;
+        bytes_ = la_bytes_ = static_cast<std::size_t>(token_end - base);
+    }
+
+    [[nodiscard]] auto line() const -> std::size_t { return line_; }
+
+    [[nodiscard]] auto line_start() const -> std::size_t { return line_start_; }
+
+    void set_line(std::size_t number, std::size_t start_offset)
+    {
+        line_ = number;
+        line_start_ = start_offset;
+    }
+};
@@ -0,0 +1,96 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#define SOURCE_PADDING 64
+
+typedef struct
+{
+    const char* base;
+    const char* cur;
+    const char* la;
+    const char* end;
+    const char* tok_start;
+
+    size_t bytes;
+    size_t la_bytes;
+} Source;
+
+/* *end must be '\0', followed by SOURCE_PADDING readable bytes */
+static void Source_init(Source* s, const char* begin, const char* end)
+{
+    s->base = begin;
+    s->cur = begin;
+    s->la = begin;
+    s->end = end;
+    s->tok_start = begin;
+    s->bytes = 0;
+    s->la_bytes = 0;
+}
+
+static int Source_peek(Source* s)
+{
+    if (s->la >= s->end)
+    {
+        return 0;
+    }
+
+    unsigned char ch = (unsigned char)*s->la++;
+    s->la_bytes++;
+
+    return ch;
+}
+
+static void Source_accept(Source* s)
+{
+    s->cur = s->la;
+    s->bytes = s->la_bytes;
+}
+
+static void Source_backtrack(Source* s)
+{
+    s->la = s->cur;
+    s->la_bytes = s->bytes;
+}
+
+static void Source_start_token(Source* s) { s->tok_start = s->cur; }
+
+static lex_text Source_text(const Source* s)
+{
+    lex_text t;
+    t.ptr = s->tok_start;
+    t.len = (size_t)(s->cur - s->tok_start);
+    return t;
+}
+
+static size_t Source_bytes(const Source* s) { return s->bytes; }
+
+static lex_text Source_remaining(const Source* s)
+{
+    lex_text t;
+    t.ptr = s->la;
+    t.len = (size_t)(s->end - s->la);
+    return t;
+}
+
+static void Source_skip(Source* s, size_t n)
+{
+    s->la += n;
+    s->la_bytes += n;
+}
+
+/* lets --simd output detect the bulk-scan hooks */
+#define Source_remaining Source_remaining
+#define Source_skip Source_skip
+
+static const char* Source_begin(const Source* s) { return s->base; }
+
+static const char* Source_cursor(const Source* s) { return s->cur; }
+
+static const char* Source_end(const Source* s) { return s->end; }
+
+static void Source_commit(Source* s, const char* token_start, const char* token_end)
+{
+    s->tok_start = token_start;
+    s->cur = s->la = token_end;
+    s->bytes = s->la_bytes = (size_t)(token_end - s->base);
+}
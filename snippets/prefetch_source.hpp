@@ -0,0 +1,200 @@
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Like stream_source, but a helper thread reads the file ahead into a ring of blocks while the lexer scans, so a refill is a memcpy
+// instead of a read() that waits on the disk. Each block is handed over through its own atomic flag (single producer, single
+// consumer): no locks, and waiting blocks on the flag instead of spinning.
+class prefetch_source
+{
+    static constexpr std::size_t block = 64 * 1024;
+    static constexpr std::size_t depth = 3;
+
+    struct slot
+    {
+        std::unique_ptr<char[]> data = std::make_unique<char[]>(block);
+        std::size_t len = 0;
+        int error = 0;
+        std::atomic<bool> full{false};
+    };
+
+    int fd;
+    std::array<slot, depth> ring;
+    std::size_t next_slot = 0; // the lexer's next block
+    std::atomic<bool> stop{false};
+    std::atomic<std::uint64_t> read_ns{0};
+    std::atomic<std::uint64_t> read_bytes{0};
+    std::uint64_t wait_ns = 0;
+    std::thread reader;
+
+    std::vector<char> buf = std::vector<char>(2 * block);
+    std::size_t len = 0;
+    std::size_t tok = 0;
+    std::size_t cur = 0;
+    std::size_t la = 0;
+    std::size_t offset = 0;
+    bool eof = false;
+
+    static auto now_ns() -> std::uint64_t
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void read_ahead()
+    {
+        off_t pos = 0;
+        for (std::size_t i = 0;; i = (i + 1) % depth)
+        {
+            auto& s = ring[i];
+            s.full.wait(true, std::memory_order_acquire);
+            if (stop.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+
+            auto t0 = now_ns();
+            ssize_t got = 0;
+            do
+            {
+                got = ::pread(fd, s.data.get(), block, pos);
+            } while (got == -1 && errno == EINTR);
+            read_ns.fetch_add(now_ns() - t0, std::memory_order_relaxed);
+
+            s.error = got == -1 ? errno : 0;
+            s.len = got > 0 ? static_cast<std::size_t>(got) : 0;
+            pos += static_cast<off_t>(s.len);
+            read_bytes.fetch_add(s.len, std::memory_order_relaxed);
+
+            s.full.store(true, std::memory_order_release);
+            s.full.notify_one();
+            if (s.len == 0)
+            {
+                return; // EOF or error, the lexer finds out from the slot
+            }
+        }
+    }
+
+    auto refill() -> bool
+    {
+        if (eof)
+        {
+            return false;
+        }
+
+        if (buf.size() - len < block)
+        {
+            std::memmove(buf.data(), buf.data() + tok, len - tok);
+            len -= tok;
+            cur -= tok;
+            la -= tok;
+            offset += tok;
+            tok = 0;
+
+            if (buf.size() - len < block)
+            {
+                buf.resize(len + block);
+            }
+        }
+
+        auto& s = ring[next_slot];
+        if (!s.full.load(std::memory_order_acquire))
+        {
+            auto t0 = now_ns();
+            s.full.wait(false, std::memory_order_acquire);
+            wait_ns += now_ns() - t0;
+        }
+
+        if (s.error != 0)
+        {
+            eof = true;
+            throw std::system_error(s.error, std::generic_category(), "pread");
+        }
+
+        std::memcpy(buf.data() + len, s.data.get(), s.len);
+        len += s.len;
+        eof = s.len == 0;
+
+        s.full.store(false, std::memory_order_release);
+        s.full.notify_one();
+        next_slot = (next_slot + 1) % depth;
+        return !eof;
+    }
+
+public:
+    struct io_stats
+    {
+        std::uint64_t bytes;  // read from the file so far
+        double read_seconds;  // spent by the reader thread inside pread()
+        double wait_seconds;  // spent by the lexer waiting for a block
+    };
+
+    explicit prefetch_source(const std::string& path) : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC))
+    {
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        }
+
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        reader = std::thread([this] { read_ahead(); });
+    }
+
+    prefetch_source(const prefetch_source&) = delete;
+    auto operator=(const prefetch_source&) -> prefetch_source& = delete;
+
+    ~prefetch_source()
+    {
+        stop.store(true, std::memory_order_relaxed);
+        for (auto& s : ring)
+        {
+            s.full.store(false, std::memory_order_release);
+            s.full.notify_one();
+        }
+        reader.join();
+        ::close(fd);
+    }
+
+    [[nodiscard]] auto stats() const -> io_stats
+    {
+        return {read_bytes.load(std::memory_order_relaxed), static_cast<double>(read_ns.load(std::memory_order_relaxed)) / 1e9,
+                static_cast<double>(wait_ns) / 1e9};
+    }
+
+    auto peek() -> std::uint8_t
+    {
+        if (la == len && !refill())
+        {
+            return 0;
+        }
+
+        return static_cast<std::uint8_t>(buf[la++]);
+    }
+
+    void accept() { cur = la; }
+
+    void backtrack() { la = cur; }
+
+    void start_token() { tok = cur; }
+
+    [[nodiscard]] auto text() const -> std::string_view { return {buf.data() + tok, cur - tok}; }
+
+    [[nodiscard]] auto bytes() const -> std::size_t { return offset + cur; }
+
+    [[nodiscard]] auto remaining() const -> std::string_view { return {buf.data() + la, len - la}; }
+
+    void skip(std::size_t n) { la += n; }
+};
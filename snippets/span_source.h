@@ -3,6 +3,7 @@
 
 typedef struct
 {
+    const char* base;
     const char* cur;
     const char* la;
     const char* end;
@@ -14,6 +15,7 @@ typedef struct
 
 static void Source_init(Source* s, const char* begin, const char* end)
 {
+    s->base = begin;
     s->cur = begin;
     s->la = begin;
     s->end = end;
@@ -59,8 +61,6 @@ static lex_text Source_text(const Source* s)
 
 static size_t Source_bytes(const Source* s) { return s->bytes; }
 
-#define LEXGEN_C_SOURCE_HAS_SCAN 1
-
 static lex_text Source_remaining(const Source* s)
 {
     lex_text t;
@@ -74,3 +74,21 @@ static void Source_skip(Source* s, size_t n)
     s->la += n;
     s->la_bytes += n;
 }
+
+/* lets --simd output detect the bulk-scan hooks */
+#define Source_remaining Source_remaining
+#define Source_skip Source_skip
+
+/* raw-cursor protocol, used by --batch output */
+static const char* Source_begin(const Source* s) { return s->base; }
+
+static const char* Source_cursor(const Source* s) { return s->cur; }
+
+static const char* Source_end(const Source* s) { return s->end; }
+
+static void Source_commit(Source* s, const char* token_start, const char* token_end)
+{
+    s->tok_start = token_start;
+    s->cur = s->la = token_end;
+    s->bytes = s->la_bytes = (size_t)(token_end - s->base);
+}
@@ -4,20 +4,25 @@
 
 class span_source
 {
+    const char* base;
     const char* cur;
     const char* la;
-    const char* end;
+    const char* end_;
     const char* tok_start = nullptr;
 
     std::size_t bytes_ = 0;
     std::size_t la_bytes_ = 0;
 
+    // for --track-lines output
+    std::size_t line_ = 1;
+    std::size_t line_start_ = 0;
+
 public:
-    span_source(const char* begin, const char* end) : cur(begin), la(begin), end(end) {}
+    span_source(const char* begin, const char* end) : base(begin), cur(begin), la(begin), end_(end) {}
 
     auto peek() -> std::uint8_t
     {
-        if (la >= end)
+        if (la >= end_)
         {
             return 0;
         }
@@ -46,11 +51,34 @@ public:
 
     [[nodiscard]] auto bytes() const -> std::size_t { return bytes_; }
 
-    [[nodiscard]] auto remaining() const -> std::string_view { return {la, static_cast<std::size_t>(end - la)}; }
+    [[nodiscard]] auto remaining() const -> std::string_view { return {la, static_cast<std::size_t>(end_ - la)}; }
 
     void skip(std::size_t n)
     {
         la += n;
         la_bytes_ += n;
     }
+
+    [[nodiscard]] auto begin() const -> const char* { return base; }
+
+    [[nodiscard]] auto cursor() const -> const char* { return cur; }
+
+    [[nodiscard]] auto end() const -> const char* { return end_; }
+
+    void commit(const char* token_start, const char* token_end)
+    {
+        tok_start = token_start;
+        cur = la = token_end;
+        bytes_ = la_bytes_ = static_cast<std::size_t>(token_end - base);
+    }
+
+    [[nodiscard]] auto line() const -> std::size_t { return line_; }
+
+    [[nodiscard]] auto line_start() const -> std::size_t { return line_start_; }
+
+    void set_line(std::size_t number, std::size_t start_offset)
+    {
+        line_ = number;
+        line_start_ = start_offset;
+    }
 };
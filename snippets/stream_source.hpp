@@ -1,53 +1,80 @@
 #include <cstddef>
 #include <cstdint>
-#include <deque>
+#include <cstring>
 #include <istream>
-#include <string>
 #include <string_view>
+#include <vector>
 
+// Reads the stream in blocks. Refilling moves the current token to the front of the buffer rather than copying it out, so text() is a
+// view into the buffer: it stays valid until the scanner reads past the buffered bytes again, i.e. until the next token is scanned.
 class stream_source
 {
+    static constexpr std::size_t block = 64 * 1024;
+
     std::istream& in;
-    std::deque<char> buf;
-    std::size_t peek_index = 0;
-    std::string text_buf;
+    std::vector<char> buf = std::vector<char>(block);
+    std::size_t len = 0; // valid bytes in buf
+    std::size_t tok = 0;
+    std::size_t cur = 0;
+    std::size_t la = 0;
+    std::size_t offset = 0; // stream offset of buf[0]
+    bool eof = false;
+
+    auto refill() -> bool
+    {
+        if (eof)
+        {
+            return false;
+        }
+
+        if (buf.size() - len < block)
+        {
+            // only the current token (and its lookahead) has to survive
+            std::memmove(buf.data(), buf.data() + tok, len - tok);
+            len -= tok;
+            cur -= tok;
+            la -= tok;
+            offset += tok;
+            tok = 0;
 
-    std::size_t bytes_ = 0;
-    std::size_t la_bytes_ = 0;
+            if (buf.size() - len < block)
+            {
+                buf.resize(len + block);
+            }
+        }
+
+        in.read(buf.data() + len, static_cast<std::streamsize>(block));
+        auto got = static_cast<std::size_t>(in.gcount());
+        len += got;
+        eof = got == 0;
+        return !eof;
+    }
 
 public:
     explicit stream_source(std::istream& in) : in(in) {}
 
     auto peek() -> std::uint8_t
     {
-        if (peek_index < buf.size())
+        if (la == len && !refill())
         {
-            return static_cast<std::uint8_t>(buf[peek_index++]);
+            return 0;
         }
 
-        char ch = 0;
-        in.get(ch);
+        return static_cast<std::uint8_t>(buf[la++]);
+    }
 
-        la_bytes_++;
+    void accept() { cur = la; }
 
-        buf.push_back(ch);
-        peek_index++;
-        return static_cast<std::uint8_t>(ch);
-    }
+    void backtrack() { la = cur; }
 
-    void accept()
-    {
-        text_buf.insert(text_buf.end(), buf.begin(), buf.begin() + static_cast<std::ptrdiff_t>(peek_index));
-        buf.erase(buf.begin(), buf.begin() + static_cast<std::ptrdiff_t>(peek_index));
-        peek_index = 0;
-        bytes_ = la_bytes_;
-    }
+    void start_token() { tok = cur; }
 
-    void backtrack() { peek_index = 0; }
+    [[nodiscard]] auto text() const -> std::string_view { return {buf.data() + tok, cur - tok}; }
 
-    void start_token() { text_buf.clear(); }
+    [[nodiscard]] auto bytes() const -> std::size_t { return offset + cur; }
 
-    [[nodiscard]] auto text() const -> std::string_view { return text_buf; }
+    // the rest of the current block; lets --simd output scan streams too
+    [[nodiscard]] auto remaining() const -> std::string_view { return {buf.data() + la, len - la}; }
 
-    [[nodiscard]] auto bytes() const -> std::size_t { return bytes_; }
+    void skip(std::size_t n) { la += n; }
 };
@@ -3,9 +3,11 @@
 #include "machine/interval_set.h"
 #include "machine/nfa.h"
 #include "regex.h"
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -15,23 +17,75 @@ auto lexergen::make_lexer(const std::vector<rule_def>& table) -> std::pair<dfa,
     for (const auto& entry : table)
     {
         entry.expr->collect_charsets(charsets);
+        if (entry.trailing)
+        {
+            entry.trailing->collect_charsets(charsets);
+        }
     }
 
     nfa_builder nfa(equivalence_classes::build(charsets));
     int64_t node_alloc = 0;
     int64_t start = node_alloc++;
     std::unordered_map<int64_t, std::string> handler_map;
+    std::unordered_map<int64_t, int64_t> rule_ids;
+    std::unordered_set<int64_t> batch_handlers;
+    std::unordered_map<int64_t, int64_t> token_rules;
+    std::unordered_map<int64_t, trailing_cut> trailing_rules;
+    std::vector<int64_t> ambiguous_trailing;
+    // without codepoints above 0xFF the DFA reads bytes, so any single class is one byte
+    const bool byte_level = nfa.get_classes().max_codepoint() <= 0xFF;
 
-    for (const auto& entry : table)
+    for (std::size_t i = 0; i < table.size(); i++)
     {
+        const auto& entry = table[i];
         auto [s, e] = entry.expr->generate(nfa, node_alloc, nfa.get_classes());
         nfa.epsilon(start, s);
+
+        // `/r/s/`: the rule accepts at the end of s; the token ends at the end of r, wherever the cheapest of these finds it
+        if (entry.trailing)
+        {
+            auto [trail_s, trail_e] = entry.trailing->generate(nfa, node_alloc, nfa.get_classes());
+            nfa.epsilon(e, trail_s);
+            if (auto length = entry.trailing->fixed_length(byte_level))
+            {
+                trailing_rules[trail_e] = {.cut = trailing_cut::kind::TAIL, .length = *length};
+            }
+            else if (auto head_length = entry.expr->fixed_length(byte_level))
+            {
+                trailing_rules[trail_e] = {.cut = trailing_cut::kind::HEAD, .length = *head_length};
+            }
+            else
+            {
+                trailing_rules[trail_e] = {.cut = trailing_cut::kind::MARK};
+                nfa.add_trail_mark(e, trail_e);
+                if (nfa.trailing_ambiguous(s, e, trail_s, trail_e))
+                {
+                    ambiguous_trailing.push_back(static_cast<int64_t>(i));
+                }
+            }
+            e = trail_e;
+        }
+
         nfa.add_end(e, entry.priority);
         handler_map[e] = entry.handler;
+        rule_ids[e] = static_cast<int64_t>(i);
+        if (entry.batch_handler)
+        {
+            batch_handlers.insert(e);
+        }
+        if (entry.token_kind != -1)
+        {
+            token_rules[e] = entry.token_kind;
+        }
     }
 
     nfa.add_start(start);
     auto dfa = nfa.build();
     dfa.handler_map = std::move(handler_map);
+    dfa.rule_ids = std::move(rule_ids);
+    dfa.batch_handlers = std::move(batch_handlers);
+    dfa.token_rules = std::move(token_rules);
+    dfa.trailing_rules = std::move(trailing_rules);
+    dfa.ambiguous_trailing = std::move(ambiguous_trailing);
     return {dfa, nfa};
 }
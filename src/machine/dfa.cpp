@@ -5,11 +5,18 @@
 #include "machine/data.h"
 #include "machine/equivalence_classes.h"
 #include "utils.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
 #include <cstddef>
 #include <cstdint>
 #include <format>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <span>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -164,6 +171,16 @@ auto lexergen::dfa::reconstruct(const std::vector<state_set>& partitions) -> voi
         new_end_to_nfa_state[new_state] = end_to_nfa_state[new_to_old[new_state]];
     }
 
+    if (!trail_marks.empty())
+    {
+        std::vector<std::vector<int64_t>> new_trail_marks(curr_id);
+        for (int64_t new_state = 0; new_state < curr_id; new_state++)
+        {
+            new_trail_marks[new_state] = trail_marks[new_to_old[new_state]];
+        }
+        trail_marks = std::move(new_trail_marks);
+    }
+
     transition_table = new_transition_table;
     start_state = old_to_new[start_state];
     end_bitmask = new_end_bitmask;
@@ -197,6 +214,25 @@ void lexergen::dfa::optimize(bool debug)
         }
     }
 
+    // states that record different trailing context marks do different work on entry, so they can't merge either
+    if (!trail_marks.empty())
+    {
+        std::unordered_set<state_set> refined;
+        for (const auto& group : initial)
+        {
+            std::map<std::vector<int64_t>, state_set> by_marks;
+            for (auto state : group)
+            {
+                by_marks[trail_marks[state]].insert(state);
+            }
+            for (auto& [marks, states] : by_marks)
+            {
+                refined.insert(std::move(states));
+            }
+        }
+        initial = std::move(refined);
+    }
+
     auto partitions = hopcroft(initial);
 
     if (debug)
@@ -222,6 +258,13 @@ namespace
         const std::vector<bool>& end_bitmask;
         const std::vector<int64_t>& end_to_nfa_state;
         const std::unordered_map<int64_t, std::string>& handler_map;
+        const std::unordered_map<int64_t, int64_t>& rule_ids;
+        const std::unordered_set<int64_t>& batch_handlers;
+        const std::unordered_map<int64_t, int64_t>& token_rules;
+        const std::unordered_map<int64_t, lexergen::trailing_cut>& trailing_rules;
+        const std::vector<std::vector<int64_t>>& trail_marks;
+        // --linear: the states checked against and recorded in the memo, in slot order
+        const std::vector<int64_t>& memo_states;
         const lexergen::equivalence_classes& classes;
         std::string_view fn_name;
         bool emit_prelude;
@@ -246,15 +289,119 @@ namespace
 
     auto needs_unicode_decode(const dfa_view& dfa) -> bool { return dfa.classes.max_codepoint() > 0xFF; }
 
+    // ICU-style three-stage lookup for codepoint classes: STAGE1[cp >> 10] + ((cp >> 4) & 0x3F) indexes STAGE2, which holds the
+    // offset of a 16-codepoint block of classes in STAGE3. Identical blocks are shared at both levels, and the first 0x80 entries of
+    // STAGE3 are the ASCII classes verbatim so the common case is a single load. The domain covers every value the emitted UTF-8
+    // decoders can return (3 + 3 * 6 payload bits), so lookups need no range check.
+    constexpr uint32_t CP_TRIE_DOMAIN = 0x200000;
+    constexpr uint32_t CP_STAGE1_SHIFT = 10;
+    constexpr uint32_t CP_STAGE3_SHIFT = 4;
+    constexpr uint32_t CP_ASCII_END = 0x80;
+
+    struct codepoint_trie
+    {
+        std::vector<uint32_t> stage1, stage2, stage3;
+    };
+
+    auto build_codepoint_trie(const lexergen::equivalence_classes& classes) -> codepoint_trie
+    {
+        constexpr uint32_t block3 = 1U << CP_STAGE3_SHIFT;
+        constexpr uint32_t block2 = 1U << (CP_STAGE1_SHIFT - CP_STAGE3_SHIFT);
+
+        codepoint_trie trie;
+        std::map<std::vector<uint32_t>, uint32_t> seen3;
+        std::map<std::vector<uint32_t>, uint32_t> seen2;
+
+        for (uint32_t hi = 0; hi < CP_TRIE_DOMAIN; hi += block3 * block2)
+        {
+            std::vector<uint32_t> offsets;
+            for (uint32_t lo = hi; lo < hi + (block3 * block2); lo += block3)
+            {
+                std::vector<uint32_t> block;
+                for (uint32_t cp = lo; cp < lo + block3; cp++)
+                {
+                    block.push_back(static_cast<uint32_t>(classes.classify(cp)));
+                }
+
+                auto offset = static_cast<uint32_t>(trie.stage3.size());
+                if (lo < CP_ASCII_END)
+                {
+                    trie.stage3.insert(trie.stage3.end(), block.begin(), block.end());
+                }
+                else if (auto [iter, inserted] = seen3.try_emplace(std::move(block), offset); !inserted)
+                {
+                    offset = iter->second;
+                }
+                else
+                {
+                    trie.stage3.insert(trie.stage3.end(), iter->first.begin(), iter->first.end());
+                }
+                offsets.push_back(offset);
+            }
+
+            auto offset = static_cast<uint32_t>(trie.stage2.size());
+            if (auto [iter, inserted] = seen2.try_emplace(std::move(offsets), offset); !inserted)
+            {
+                offset = iter->second;
+            }
+            else
+            {
+                trie.stage2.insert(trie.stage2.end(), iter->first.begin(), iter->first.end());
+            }
+            trie.stage1.push_back(offset);
+        }
+
+        return trie;
+    }
+
+    auto c_table_type(const std::vector<uint32_t>& values) -> std::string_view
+    {
+        auto max = values.empty() ? 0 : std::ranges::max(values);
+        return max <= UINT8_MAX ? "uint8_t" : max <= UINT16_MAX ? "uint16_t" : "uint32_t";
+    }
+
+    auto js_table_type(const std::vector<uint32_t>& values) -> std::string_view
+    {
+        auto max = values.empty() ? 0 : std::ranges::max(values);
+        return max <= UINT8_MAX ? "Uint8Array" : max <= UINT16_MAX ? "Uint16Array" : "Uint32Array";
+    }
+
+    // javac caps a method (including the static initializer) at 64K of bytecode, which a large array literal blows through, so Java
+    // tables travel as string constants of (high, low) char pairs instead, chunked to stay under the 64K constant pool entry limit
+    auto java_table_literal(const std::vector<uint32_t>& values, std::string_view unpack_fn) -> std::string
+    {
+        constexpr std::size_t chunk_values = 4096;
+
+        auto escape = [](uint32_t ch) -> std::string
+        {
+            // \u escapes are translated before lexing, so \u000a would end the literal; octal escapes aren't
+            return ch <= 0xFF ? std::format("\\{:03o}", ch) : std::format("\\u{:04x}", ch);
+        };
+
+        std::string result = std::format("{}(", unpack_fn);
+        for (std::size_t i = 0; i < values.size(); i++)
+        {
+            if (i % chunk_values == 0)
+            {
+                result += i == 0 ? "\"" : "\",\n    \"";
+            }
+            result += escape(values[i] >> 16) + escape(values[i] & 0xFFFF);
+        }
+        result += values.empty() ? "\"\")" : "\")";
+        return result;
+    }
+
+    // stop sets up to this size are tested with one compare per byte value; larger ones go through the nibble tables (see nibble_rows)
     constexpr std::size_t SIMD_MAX_STOP_BYTES = 8;
+    // the portable SWAR tier tests larger sets as unions of allowed byte ranges, costing a handful of word ops per range
+    constexpr std::size_t SWAR_MAX_RANGES = 4;
 
+    // For codepoint-decoding DFAs only ASCII codepoints map 1:1 onto bytes, so every byte >= 0x80 is a stop: the scan skips runs of
+    // safe ASCII and leaves multibyte sequences to the decoder.
     auto find_simd_states(const dfa_view& dfa) -> std::unordered_map<int64_t, std::vector<char>>
     {
         std::unordered_map<int64_t, std::vector<char>> result;
-        if (needs_unicode_decode(dfa))
-        {
-            return result;
-        }
+        const auto max_safe = needs_unicode_decode(dfa) ? CP_ASCII_END - 1 : 0xFF;
 
         const auto row_width = static_cast<int64_t>(dfa.classes.class_count()) + 1;
 
@@ -277,7 +424,7 @@ namespace
                 }
 
                 auto interval = dfa.classes.class_interval(class_id);
-                for (auto cp = interval.lo; cp <= interval.hi && cp <= 0xFF; cp++)
+                for (auto cp = interval.lo; cp <= interval.hi && cp <= max_safe; cp++)
                 {
                     safe[cp] = true;
                 }
@@ -289,7 +436,7 @@ namespace
             }
 
             std::vector<char> stops;
-            for (int byte = 0; byte < 256 && stops.size() <= SIMD_MAX_STOP_BYTES; byte++)
+            for (int byte = 0; byte < 256; byte++)
             {
                 if (!safe[static_cast<std::size_t>(byte)])
                 {
@@ -297,7 +444,7 @@ namespace
                 }
             }
 
-            if (!stops.empty() && stops.size() <= SIMD_MAX_STOP_BYTES)
+            if (!stops.empty() && stops.size() < safe.size())
             {
                 result[state] = std::move(stops);
             }
@@ -310,12 +457,214 @@ namespace
     {
         out << R"cpp(#ifndef LEXGEN_SIMD_SCAN_DEFINED
 #define LEXGEN_SIMD_SCAN_DEFINED
-namespace lexgen_simd {
-
+// GCC/Clang on x86 also build the AVX2/AVX-512BW kernels with target attributes and pick one from CPUID at startup, so a
+// baseline x86-64 build still uses the widest kernel the host supports; define LEXGEN_SIMD_NO_DISPATCH to only use the -m flags.
+// Without x86 SIMD the portable SWAR tier runs; define LEXGEN_SIMD_FORCE_SWAR to use it everywhere (e.g. to test it on x86).
+#if !defined(LEXGEN_SIMD_FORCE_SWAR)
+#if defined(__AVX512BW__)
+#define LEXGEN_SIMD_HAS_AVX512BW 1
+#endif
 #if defined(__AVX2__)
+#define LEXGEN_SIMD_HAS_AVX2 1
+#endif
+#if defined(__SSE4_2__)
+#define LEXGEN_SIMD_HAS_SSE42 1
+#endif
+#if defined(__SSSE3__)
+#define LEXGEN_SIMD_HAS_SSSE3 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LEXGEN_SIMD_HAS_SSE2 1
+#endif
+#if !defined(LEXGEN_SIMD_NO_DISPATCH) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LEXGEN_SIMD_DISPATCH 1
+#endif
+#endif
+#if defined(LEXGEN_SIMD_DISPATCH)
+#define LEXGEN_SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define LEXGEN_SIMD_TARGET(isa)
+#endif
+#if defined(LEXGEN_SIMD_HAS_AVX512BW) || defined(LEXGEN_SIMD_DISPATCH)
+#define LEXGEN_SIMD_AVX512BW 1
+#endif
+#if defined(LEXGEN_SIMD_HAS_AVX2) || defined(LEXGEN_SIMD_DISPATCH)
+#define LEXGEN_SIMD_AVX2 1
+#endif
+
+#if defined(LEXGEN_SIMD_AVX512BW) || defined(LEXGEN_SIMD_AVX2)
 #include <immintrin.h>
+#elif defined(LEXGEN_SIMD_HAS_SSE42)
+#include <nmmintrin.h>
+#elif defined(LEXGEN_SIMD_HAS_SSSE3)
+#include <tmmintrin.h>
+#elif defined(LEXGEN_SIMD_HAS_SSE2)
+#include <emmintrin.h>
+#endif
+#include <cstdint>
+#include <cstring>
+
+namespace lexgen_simd {
+
+inline std::size_t first_set_bit(unsigned bits)
+{
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, bits);
+    return idx;
+#else
+    return static_cast<std::size_t>(__builtin_ctz(bits));
+#endif
+}
+
+inline std::size_t last_set_bit(unsigned bits)
+{
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanReverse(&idx, bits);
+    return idx;
+#else
+    return static_cast<std::size_t>(31 - __builtin_clz(bits));
+#endif
+}
+
+inline std::size_t popcount(unsigned bits)
+{
+#if defined(_MSC_VER)
+    return __popcnt(bits);
+#else
+    return static_cast<std::size_t>(__builtin_popcount(bits));
+#endif
+}
+
+// for --track-lines: adds the newlines among the `n` bytes a scan just skipped to `line`, moves `line_start` past the last one, and
+// returns `n`; the bytes were just read, so this second pass runs from cache
+inline std::size_t count_lines(const char* p, std::size_t n, std::size_t& line, const char*& line_start)
+{
+    std::size_t i = 0;
+    std::size_t count = 0;
+    const char* last = nullptr;
+#if defined(LEXGEN_SIMD_HAS_SSE2)
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16)
+    {
+        unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), newline)));
+        if (bits != 0)
+        {
+            count += popcount(bits);
+            last = p + i + last_set_bit(bits);
+        }
+    }
+#endif
+    for (; i < n; i++)
+    {
+        if (p[i] == '\n')
+        {
+            count++;
+            last = p + i;
+        }
+    }
+    if (last != nullptr)
+    {
+        line += count;
+        line_start = last + 1;
+    }
+    return n;
+}
+
+// Arbitrary stop sets: Rows[lo | (hi & 8) << 1] has bit (hi & 7) set when byte (hi << 4 | lo) stops the run. The low nibble (with bit 7
+// kept, so PSHUFB zeroes the half that doesn't apply) picks a row from each table, the high nibble picks the bit.
+// scan_set_run<byte_ranges<Lo, Hi, ...>, Rows...> also gets the bytes that continue the run as inclusive ranges, for the SWAR tier.
+template <unsigned char... Rows>
+inline bool in_stop_set(char c)
+{
+    static constexpr unsigned char rows[32] = {Rows...};
+    auto b = static_cast<unsigned char>(c);
+    return ((rows[(b & 0x0F) | ((b & 0x80) >> 3)] >> ((b >> 4) & 7)) & 1) != 0;
+}
+
+template <unsigned char... Bounds>
+struct byte_ranges
+{
+    static_assert(sizeof...(Bounds) % 2 == 0);
+};
+
+#if defined(LEXGEN_SIMD_AVX512BW)
+namespace avx512bw {
+
+inline std::size_t first_set_bit64(unsigned long long bits)
+{
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, bits);
+    return idx;
+#else
+    return static_cast<std::size_t>(__builtin_ctzll(bits));
+#endif
+}
+
+// 64 bytes per step; the last partial chunk is read with a masked load (masked-off lanes can't fault) instead of a scalar loop
+inline __mmask64 tail_mask(std::size_t left) { return left >= 64 ? ~__mmask64{0} : (__mmask64{1} << left) - 1; }
+
 template <char... Stops>
-inline std::size_t scan_safe_run(const char* p, std::size_t n)
+LEXGEN_SIMD_TARGET("avx512bw") inline __mmask64 stop_mask(__m512i chunk)
+{
+    __mmask64 hits = 0;
+    ((hits |= _mm512_cmpeq_epi8_mask(chunk, _mm512_set1_epi8(Stops))), ...);
+    return hits;
+}
+
+template <char... Stops>
+LEXGEN_SIMD_TARGET("avx512bw") inline std::size_t scan_safe_run(const char* p, std::size_t n)
+{
+    std::size_t i = 0;
+    while (i + 64 <= n)
+    {
+        __mmask64 hits = stop_mask<Stops...>(_mm512_loadu_si512(p + i));
+        if (hits != 0) { return i + first_set_bit64(hits); }
+        i += 64;
+    }
+    __mmask64 valid = tail_mask(n - i);
+    __mmask64 hits = stop_mask<Stops...>(_mm512_maskz_loadu_epi8(valid, p + i)) & valid;
+    return hits != 0 ? i + first_set_bit64(hits) : n;
+}
+
+LEXGEN_SIMD_TARGET("avx512bw") inline __mmask64 set_mask(__m512i chunk, __m512i rows_lo, __m512i rows_hi, __m512i bit_lut)
+{
+    __m512i idx = _mm512_and_si512(chunk, _mm512_set1_epi8(static_cast<char>(0x8F)));
+    __m512i row = _mm512_or_si512(_mm512_shuffle_epi8(rows_lo, idx), _mm512_shuffle_epi8(rows_hi, _mm512_xor_si512(idx, _mm512_set1_epi8(static_cast<char>(0x80)))));
+    __m512i bit = _mm512_shuffle_epi8(bit_lut, _mm512_and_si512(_mm512_srli_epi16(chunk, 4), _mm512_set1_epi8(0x0F)));
+    return _mm512_test_epi8_mask(row, bit);
+}
+
+template <typename Ranges, unsigned char... Rows>
+LEXGEN_SIMD_TARGET("avx512bw") inline std::size_t scan_set_run(const char* p, std::size_t n)
+{
+    static_assert(sizeof...(Rows) == 32);
+    alignas(16) static constexpr unsigned char rows[32] = {Rows...};
+    const __m512i rows_lo = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_load_si128(reinterpret_cast<const __m128i*>(rows)));
+    const __m512i rows_hi = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_load_si128(reinterpret_cast<const __m128i*>(rows + 16)));
+    const __m512i bit_lut = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128));
+    std::size_t i = 0;
+    while (i + 64 <= n)
+    {
+        __mmask64 hits = set_mask(_mm512_loadu_si512(p + i), rows_lo, rows_hi, bit_lut);
+        if (hits != 0) { return i + first_set_bit64(hits); }
+        i += 64;
+    }
+    __mmask64 valid = tail_mask(n - i);
+    __mmask64 hits = set_mask(_mm512_maskz_loadu_epi8(valid, p + i), rows_lo, rows_hi, bit_lut) & valid;
+    return hits != 0 ? i + first_set_bit64(hits) : n;
+}
+
+} // namespace avx512bw
+#endif
+
+#if defined(LEXGEN_SIMD_AVX2)
+namespace avx2 {
+
+template <char... Stops>
+LEXGEN_SIMD_TARGET("avx2") inline std::size_t scan_safe_run(const char* p, std::size_t n)
 {
     std::size_t i = 0;
     while (i + 32 <= n)
@@ -324,16 +673,7 @@ inline std::size_t scan_safe_run(const char* p, std::size_t n)
         __m256i mask = _mm256_setzero_si256();
         ((mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(Stops)))), ...);
         unsigned bits = static_cast<unsigned>(_mm256_movemask_epi8(mask));
-        if (bits != 0)
-        {
-#if defined(_MSC_VER)
-            unsigned long idx;
-            _BitScanForward(&idx, bits);
-            return i + idx;
-#else
-            return i + static_cast<std::size_t>(__builtin_ctz(bits));
-#endif
-        }
+        if (bits != 0) { return i + first_set_bit(bits); }
         i += 32;
     }
     while (i < n)
@@ -344,8 +684,137 @@ inline std::size_t scan_safe_run(const char* p, std::size_t n)
     }
     return i;
 }
-#elif defined(__SSE4_2__)
-#include <nmmintrin.h>
+
+template <typename Ranges, unsigned char... Rows>
+LEXGEN_SIMD_TARGET("avx2") inline std::size_t scan_set_run(const char* p, std::size_t n)
+{
+    static_assert(sizeof...(Rows) == 32);
+    alignas(16) static constexpr unsigned char rows[32] = {Rows...};
+    const __m256i rows_lo = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(rows)));
+    const __m256i rows_hi = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(rows + 16)));
+    const __m256i bit_lut = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    std::size_t i = 0;
+    while (i + 32 <= n)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i idx = _mm256_and_si256(chunk, _mm256_set1_epi8(static_cast<char>(0x8F)));
+        __m256i row = _mm256_or_si256(_mm256_shuffle_epi8(rows_lo, idx), _mm256_shuffle_epi8(rows_hi, _mm256_xor_si256(idx, _mm256_set1_epi8(static_cast<char>(0x80)))));
+        __m256i bit = _mm256_shuffle_epi8(bit_lut, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), _mm256_set1_epi8(0x0F)));
+        unsigned bits = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit)));
+        if (bits != 0) { return i + first_set_bit(bits); }
+        i += 32;
+    }
+    while (i < n && !in_stop_set<Rows...>(p[i])) { i++; }
+    return i;
+}
+
+} // namespace avx2
+#endif
+
+// portable: eight bytes per std::uint64_t step with exact per-byte tests (carries never cross a byte lane)
+namespace swar {
+
+constexpr std::uint64_t ones = 0x0101010101010101ULL;
+constexpr std::uint64_t highs = 0x8080808080808080ULL;
+constexpr std::uint64_t lows = 0x7F7F7F7F7F7F7F7FULL;
+
+inline std::uint64_t load(const char* p, std::size_t len = 8)
+{
+    std::uint64_t w = 0;
+    std::memcpy(&w, p, len);
+    return w;
+}
+
+// high bit of every lane holding one of the first `len` bytes of a load
+inline std::uint64_t valid_lanes(std::size_t len)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return len >= 8 ? highs : highs & ~(~std::uint64_t{0} >> (8 * len));
+#else
+    return len >= 8 ? highs : highs & ((std::uint64_t{1} << (8 * len)) - 1);
+#endif
+}
+
+inline std::size_t first_lane(std::uint64_t lanes)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return static_cast<std::size_t>(__builtin_clzll(lanes)) / 8;
+#elif defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, lanes);
+    return idx / 8;
+#else
+    return static_cast<std::size_t>(__builtin_ctzll(lanes)) / 8;
+#endif
+}
+
+inline std::uint64_t zero_lanes(std::uint64_t w) { return ~(((w & lows) + lows) | w) & highs; }
+
+// lanes >= C, for 0 <= C <= 256: the low seven bits are compared with the lane's top bit forced on, so the subtraction can't borrow
+template <unsigned C>
+inline std::uint64_t ge_lanes(std::uint64_t w)
+{
+    if constexpr (C == 0) { return highs; }
+    else if constexpr (C >= 256) { return 0; }
+    else if constexpr (C < 128) { return (w | (((w & lows) | highs) - ones * C)) & highs; }
+    else { return w & (((w & lows) | highs) - ones * (C - 128)) & highs; }
+}
+
+template <char... Stops>
+inline std::uint64_t stop_lanes(std::uint64_t w)
+{
+    return (zero_lanes(w ^ (ones * static_cast<unsigned char>(Stops))) | ...);
+}
+
+template <char... Stops>
+inline std::size_t scan_safe_run(const char* p, std::size_t n)
+{
+    std::size_t i = 0;
+    while (i + 8 <= n)
+    {
+        std::uint64_t hits = stop_lanes<Stops...>(load(p + i));
+        if (hits != 0) { return i + first_lane(hits); }
+        i += 8;
+    }
+    if (i == n) { return n; }
+    std::uint64_t hits = stop_lanes<Stops...>(load(p + i, n - i)) & valid_lanes(n - i);
+    return hits != 0 ? i + first_lane(hits) : n;
+}
+
+inline std::uint64_t in_ranges(std::uint64_t, byte_ranges<>) { return 0; }
+
+template <unsigned char Lo, unsigned char Hi, unsigned char... Rest>
+inline std::uint64_t in_ranges(std::uint64_t w, byte_ranges<Lo, Hi, Rest...>)
+{
+    return (ge_lanes<Lo>(w) & ~ge_lanes<Hi + 1U>(w)) | in_ranges(w, byte_ranges<Rest...>{});
+}
+
+template <typename Ranges>
+inline std::size_t scan_set_run(const char* p, std::size_t n)
+{
+    // sets with too many ranges come with none, and are left to the DFA
+    if constexpr (std::is_same_v<Ranges, byte_ranges<>>) { return 0; }
+    else
+    {
+        std::size_t i = 0;
+        while (i + 8 <= n)
+        {
+            std::uint64_t hits = ~in_ranges(load(p + i), Ranges{}) & highs;
+            if (hits != 0) { return i + first_lane(hits); }
+            i += 8;
+        }
+        if (i == n) { return n; }
+        std::uint64_t hits = ~in_ranges(load(p + i, n - i), Ranges{}) & valid_lanes(n - i);
+        return hits != 0 ? i + first_lane(hits) : n;
+    }
+}
+
+} // namespace swar
+
+// whatever the -m flags guarantee
+namespace baseline {
+
+#if defined(LEXGEN_SIMD_HAS_SSE42)
 template <char... Stops>
 inline std::size_t scan_safe_run(const char* p, std::size_t n)
 {
@@ -360,16 +829,9 @@ inline std::size_t scan_safe_run(const char* p, std::size_t n)
         if (idx < 16) { return i + static_cast<std::size_t>(idx); }
         i += 16;
     }
-    while (i < n)
-    {
-        char c = p[i];
-        if (((c == Stops) || ...)) { return i; }
-        i++;
-    }
-    return i;
+    return i + swar::scan_safe_run<Stops...>(p + i, n - i);
 }
-#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
-#include <emmintrin.h>
+#elif defined(LEXGEN_SIMD_HAS_SSE2)
 template <char... Stops>
 inline std::size_t scan_safe_run(const char* p, std::size_t n)
 {
@@ -380,42 +842,106 @@ inline std::size_t scan_safe_run(const char* p, std::size_t n)
         __m128i mask = _mm_setzero_si128();
         ((mask = _mm_or_si128(mask, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(Stops)))), ...);
         unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(mask));
-        if (bits != 0)
-        {
-#if defined(_MSC_VER)
-            unsigned long idx;
-            _BitScanForward(&idx, bits);
-            return i + idx;
-#else
-            return i + static_cast<std::size_t>(__builtin_ctz(bits));
-#endif
-        }
+        if (bits != 0) { return i + first_set_bit(bits); }
         i += 16;
     }
-    while (i < n)
-    {
-        char c = p[i];
-        if (((c == Stops) || ...)) { return i; }
-        i++;
-    }
-    return i;
+    return i + swar::scan_safe_run<Stops...>(p + i, n - i);
 }
 #else
 template <char... Stops>
 inline std::size_t scan_safe_run(const char* p, std::size_t n)
 {
+    return swar::scan_safe_run<Stops...>(p, n);
+}
+#endif
+
+#if defined(LEXGEN_SIMD_HAS_SSSE3)
+template <typename Ranges, unsigned char... Rows>
+inline std::size_t scan_set_run(const char* p, std::size_t n)
+{
+    static_assert(sizeof...(Rows) == 32);
+    alignas(16) static constexpr unsigned char rows[32] = {Rows...};
+    const __m128i rows_lo = _mm_load_si128(reinterpret_cast<const __m128i*>(rows));
+    const __m128i rows_hi = _mm_load_si128(reinterpret_cast<const __m128i*>(rows + 16));
+    const __m128i bit_lut = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
     std::size_t i = 0;
-    while (i < n)
+    while (i + 16 <= n)
     {
-        char c = p[i];
-        if (((c == Stops) || ...)) { return i; }
-        i++;
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i idx = _mm_and_si128(chunk, _mm_set1_epi8(static_cast<char>(0x8F)));
+        __m128i row = _mm_or_si128(_mm_shuffle_epi8(rows_lo, idx), _mm_shuffle_epi8(rows_hi, _mm_xor_si128(idx, _mm_set1_epi8(static_cast<char>(0x80)))));
+        __m128i bit = _mm_shuffle_epi8(bit_lut, _mm_and_si128(_mm_srli_epi16(chunk, 4), _mm_set1_epi8(0x0F)));
+        unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), bit)));
+        if (bits != 0) { return i + first_set_bit(bits); }
+        i += 16;
     }
+    while (i < n && !in_stop_set<Rows...>(p[i])) { i++; }
     return i;
 }
+#else
+template <typename Ranges, unsigned char... Rows>
+inline std::size_t scan_set_run(const char* p, std::size_t n)
+{
+    return swar::scan_set_run<Ranges>(p, n);
+}
 #endif
 
-template <typename Source, typename = void>
+} // namespace baseline
+
+#if defined(LEXGEN_SIMD_DISPATCH)
+enum class isa_level { baseline, avx2, avx512bw };
+
+inline isa_level detect_isa_level()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) { return isa_level::avx512bw; }
+    if (__builtin_cpu_supports("avx2")) { return isa_level::avx2; }
+    return isa_level::baseline;
+}
+
+// read once per run; before dynamic initialization has run it's zero, i.e. baseline, which is always safe
+inline const isa_level host_isa_level = detect_isa_level();
+#endif
+
+template <char... Stops>
+inline std::size_t scan_safe_run(const char* p, std::size_t n)
+{
+#if defined(LEXGEN_SIMD_HAS_AVX512BW)
+    return avx512bw::scan_safe_run<Stops...>(p, n);
+#elif defined(LEXGEN_SIMD_DISPATCH)
+    switch (host_isa_level)
+    {
+    case isa_level::avx512bw: return avx512bw::scan_safe_run<Stops...>(p, n);
+    case isa_level::avx2: return avx2::scan_safe_run<Stops...>(p, n);
+    default: return baseline::scan_safe_run<Stops...>(p, n);
+    }
+#elif defined(LEXGEN_SIMD_HAS_AVX2)
+    return avx2::scan_safe_run<Stops...>(p, n);
+#else
+    return baseline::scan_safe_run<Stops...>(p, n);
+#endif
+}
+
+template <typename Ranges, unsigned char... Rows>
+inline std::size_t scan_set_run(const char* p, std::size_t n)
+{
+#if defined(LEXGEN_SIMD_HAS_AVX512BW)
+    return avx512bw::scan_set_run<Ranges, Rows...>(p, n);
+#elif defined(LEXGEN_SIMD_DISPATCH)
+    switch (host_isa_level)
+    {
+    case isa_level::avx512bw: return avx512bw::scan_set_run<Ranges, Rows...>(p, n);
+    case isa_level::avx2: return avx2::scan_set_run<Ranges, Rows...>(p, n);
+    default: return baseline::scan_set_run<Ranges, Rows...>(p, n);
+    }
+#elif defined(LEXGEN_SIMD_HAS_AVX2)
+    return avx2::scan_set_run<Ranges, Rows...>(p, n);
+#else
+    return baseline::scan_set_run<Ranges, Rows...>(p, n);
+#endif
+}
+
+template <typename Source, typename = void>
 struct has_bulk_scan : std::false_type {};
 template <typename Source>
 struct has_bulk_scan<Source, std::void_t<decltype(std::declval<Source&>().remaining()), decltype(std::declval<Source&>().skip(std::size_t{}))>>
@@ -427,249 +953,2421 @@ struct has_bulk_scan<Source, std::void_t<decltype(std::declval<Source&>().remain
 )cpp";
     }
 
-    auto emit_c_family_classifier(std::ostream& out, const dfa_view& dfa, std::string_view peek_expr, bool is_cpp) -> std::string
+    // The handler of a TOKEN rule: return the kind and the matched byte range, using the same locals as hand-written handlers do.
+    auto token_return(lexergen::target_lang lang, std::string_view kind) -> std::string
     {
-        const auto class_count = dfa.classes.class_count();
-        const auto sentinel = static_cast<int64_t>(class_count);
-        const auto prefix = std::string(dfa.fn_name) + "_";
+        switch (lang)
+        {
+        case lexergen::target_lang::CPP:
+            return std::format("return lex_token{{lex_token_kind::{}, start_bytes, static_cast<std::size_t>(src.bytes())}};", kind);
+        case lexergen::target_lang::C:
+            return std::format("return (lex_token){{LEX_TOKEN_{}, start_bytes, Source_bytes(src)}};", kind);
+        case lexergen::target_lang::JAVA:
+            return std::format("return new LexToken(LexToken.{}, startBytes, src.bytes());", kind);
+        case lexergen::target_lang::JS:
+            return std::format("return {{ kind: LexTokenKind.{}, start: startBytes, end: src.bytes() }};", kind);
+        }
+        return {};
+    }
 
-        if (!needs_unicode_decode(dfa))
+    void emit_token_types(std::ostream& out, lexergen::target_lang lang, std::span<const std::string> kinds)
+    {
+        if (kinds.empty())
         {
-            out << std::format("static const int64_t {}BYTE_CLASS[256] = {{", prefix);
-            for (int cp = 0; cp < 256; cp++)
+            return;
+        }
+
+        switch (lang)
+        {
+        case lexergen::target_lang::CPP:
+            out << "enum class lex_token_kind : uint32_t\n{\n";
+            for (std::size_t i = 0; i < kinds.size(); i++)
             {
-                out << dfa.classes.classify(static_cast<uint32_t>(cp)) << ",";
+                out << std::format("    {} = {},\n", kinds[i], i);
             }
             out << "};\n\n";
-            return std::format("{}BYTE_CLASS[(unsigned char){}]", prefix, peek_expr);
+            out << "struct lex_token\n{\n    lex_token_kind kind;\n    std::size_t start;\n    std::size_t end;\n};\n";
+            out << "static_assert(std::is_trivially_copyable_v<lex_token>);\n\n";
+            break;
+        case lexergen::target_lang::C:
+            out << "typedef enum\n{\n";
+            for (std::size_t i = 0; i < kinds.size(); i++)
+            {
+                out << std::format("    LEX_TOKEN_{} = {},\n", kinds[i], i);
+            }
+            out << "} lex_token_kind;\n\n";
+            out << "typedef struct\n{\n    lex_token_kind kind;\n    size_t start;\n    size_t end;\n} lex_token;\n\n";
+            break;
+        case lexergen::target_lang::JAVA:
+            out << "static final class LexToken\n{\n";
+            for (std::size_t i = 0; i < kinds.size(); i++)
+            {
+                out << std::format("    static final int {} = {};\n", kinds[i], i);
+            }
+            out << "\n    final int kind;\n    final long start;\n    final long end;\n\n";
+            out << "    LexToken(int kind, long start, long end)\n    {\n        this.kind = kind;\n        this.start = start;\n        this.end = end;\n    }\n}\n\n";
+            break;
+        case lexergen::target_lang::JS:
+            out << "const LexTokenKind = Object.freeze({\n";
+            for (std::size_t i = 0; i < kinds.size(); i++)
+            {
+                out << std::format("    {}: {},\n", kinds[i], i);
+            }
+            out << "});\n\n";
+            break;
+        }
+    }
+
+    void emit_raw_cursor_prelude(std::ostream& out)
+    {
+        out << R"cpp(#ifndef LEXGEN_RAW_CURSOR_DEFINED
+#define LEXGEN_RAW_CURSOR_DEFINED
+namespace lexgen_raw {
+
+template <typename Source, typename = void>
+struct has_raw_cursor : std::false_type {};
+template <typename Source>
+struct has_raw_cursor<
+    Source, std::void_t<
+                decltype(static_cast<const char*>(std::declval<Source&>().begin())), decltype(static_cast<const char*>(std::declval<Source&>().cursor())),
+                decltype(static_cast<const char*>(std::declval<Source&>().end())),
+                decltype(std::declval<Source&>().commit(std::declval<const char*>(), std::declval<const char*>()))>> : std::true_type {};
+
+} // namespace lexgen_raw
+#endif
+
+)cpp";
+    }
+
+    void emit_linear_prelude(std::ostream& out)
+    {
+        out << R"cpp(#ifndef LEXGEN_LINEAR_DEFINED
+#define LEXGEN_LINEAR_DEFINED
+#include <cstdint>
+#include <string_view>
+#include <vector>
+namespace lexgen_linear {
+
+// The (state, position) pairs from which a --linear lex_tok has already scanned on without reaching an accepting state. A later scan
+// reaching one of them gives up right there, as it would fail the same way, so no state rescans the same byte twice. Only the states
+// that can loop after an accept have a slot, at one bit per slot per byte of the buffer; binding another buffer (or lex_tok) clears it.
+// The memo can't see the buffer's contents change, so call reset() after writing to a buffer it has been used with.
+class memo
+{
+public:
+    void reset()
+    {
+        failed.assign(failed.size(), 0);
+        pending.clear();
+    }
+
+    void bind(const char* begin, const char* end, std::size_t slots, std::string_view owner)
+    {
+        if (begin == buf_begin && end == buf_end && owner == owner_name)
+        {
+            return;
         }
+        buf_begin = begin;
+        buf_end = end;
+        owner_name = owner;
+        stride = slots;
+        // +2: the cursor goes up to `end`, or one past it after reading a --sentinel
+        failed.assign((((static_cast<std::size_t>(end - begin) + 2) * slots) + 63) / 64, 0);
+        pending.clear();
+    }
 
-        const auto& boundaries = dfa.classes.get_boundaries();
-        out << std::format("static const uint32_t {}CLASS_BOUNDARIES[] = {{", prefix);
-        for (auto b : boundaries)
+    [[nodiscard]] bool seen(const char* p, std::size_t slot) const
+    {
+        auto bit = index(p, slot);
+        return ((failed[bit / 64] >> (bit % 64)) & 1) != 0;
+    }
+    void visit(const char* p, std::size_t slot) { pending.push_back(index(p, slot)); }
+    // an accepting state: everything visited so far led to it
+    void accept() { pending.clear(); }
+    // the scan stopped: everything visited since the last accept failed
+    void fail()
+    {
+        for (auto bit : pending)
         {
-            out << b << "u,";
+            failed[bit / 64] |= uint64_t{1} << (bit % 64);
         }
-        out << "};\n";
-        out << std::format("static const size_t {}CLASS_BOUNDARIES_LEN = {};\n\n", prefix, boundaries.size());
+        pending.clear();
+    }
 
-        out << std::format("static int64_t {}classify_cp(uint32_t cp)\n{{\n", prefix);
-        out << std::format("    size_t lo = 0, hi = {}CLASS_BOUNDARIES_LEN;\n", prefix);
-        out << "    while (lo + 1 < hi)\n    {\n";
-        out << "        size_t mid = lo + (hi - lo) / 2;\n";
-        out << std::format("        if ({}CLASS_BOUNDARIES[mid] <= cp) lo = mid; else hi = mid;\n", prefix);
-        out << "    }\n";
-        out << std::format("    if (lo + 1 >= {}CLASS_BOUNDARIES_LEN) return {};\n", prefix, sentinel);
-        out << "    return (int64_t)lo;\n";
-        out << "}\n\n";
+private:
+    [[nodiscard]] std::size_t index(const char* p, std::size_t slot) const { return (static_cast<std::size_t>(p - buf_begin) * stride) + slot; }
 
-        out
-            << (is_cpp ? std::format("template <typename Source>\nstatic uint32_t {}decode_utf8_cp(Source& src)\n{{\n", prefix)
-                       : std::format("static uint32_t {}decode_utf8_cp(Source *src)\n{{\n", prefix));
-        out << std::format("    uint32_t b0 = (unsigned char){};\n", peek_expr);
-        out << "    if (b0 < 0x80) return b0;\n";
-        out << "    int extra; uint32_t cp;\n";
-        out << "    if ((b0 & 0xE0) == 0xC0) { extra = 1; cp = b0 & 0x1F; }\n";
-        out << "    else if ((b0 & 0xF0) == 0xE0) { extra = 2; cp = b0 & 0x0F; }\n";
-        out << "    else if ((b0 & 0xF8) == 0xF0) { extra = 3; cp = b0 & 0x07; }\n";
-        out << "    else return 0xFFFD;\n";
-        out << "    for (int i = 0; i < extra; i++)\n    {\n";
-        out << std::format("        uint32_t bn = (unsigned char){};\n", peek_expr);
-        out << "        if ((bn & 0xC0) != 0x80) return 0xFFFD;\n";
-        out << "        cp = (cp << 6) | (bn & 0x3F);\n";
-        out << "    }\n";
-        out << "    return cp;\n";
-        out << "}\n\n";
+    const char* buf_begin = nullptr;
+    const char* buf_end = nullptr;
+    std::string_view owner_name;
+    std::size_t stride = 0;
+    std::vector<uint64_t> failed;
+    std::vector<std::size_t> pending;
+};
 
-        return std::format("{}classify_cp({}decode_utf8_cp(src))", prefix, prefix);
+} // namespace lexgen_linear
+#endif
+
+)cpp";
     }
 
-    auto emit_cpp(
-        std::ostream& out, const dfa_view& dfa, const std::string& inc, const std::string& handle_error, const std::string& handle_internal_error,
-        bool enable_simd
-    ) -> lexergen::codegen_result
+    void emit_parallel_prelude(std::ostream& out)
     {
-        if (dfa.emit_prelude)
+        out << R"cpp(#ifndef LEXGEN_PARALLEL_DEFINED
+#define LEXGEN_PARALLEL_DEFINED
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+namespace lexgen_parallel {
+
+struct tokens
+{
+    std::vector<uint32_t> kinds;
+    std::vector<std::size_t> starts;
+    std::vector<std::size_t> ends;
+};
+
+// the tokens lexed from `from`, up to (not including) the first one starting at or past `limit`
+struct chunk
+{
+    tokens toks;
+    std::size_t next = 0; // offset of that first token past `limit`, or where lexing stopped if `ended`
+    bool ended = false;   // stopped at EOF or at input no rule matches before reaching `limit`
+};
+
+inline void append(tokens& out, const tokens& in, std::size_t first)
+{
+    out.kinds.insert(out.kinds.end(), in.kinds.begin() + static_cast<std::ptrdiff_t>(first), in.kinds.end());
+    out.starts.insert(out.starts.end(), in.starts.begin() + static_cast<std::ptrdiff_t>(first), in.starts.end());
+    out.ends.insert(out.ends.end(), in.ends.begin() + static_cast<std::ptrdiff_t>(first), in.ends.end());
+}
+
+template <typename Source, typename Ctx, typename Batch>
+void lex_chunk(Batch batch, const char* begin, const char* from, const char* limit, const char* end, Ctx ctx, chunk& out)
+{
+    constexpr std::size_t block = 512;
+    uint32_t kinds[block];
+    std::size_t starts[block];
+    std::size_t ends[block];
+    Source src(from, end);
+    const auto base = static_cast<std::size_t>(from - begin);
+    const auto limit_off = static_cast<std::size_t>(limit - from);
+    for (;;)
+    {
+        std::size_t n = batch(src, ctx, kinds, starts, ends, block);
+        for (std::size_t i = 0; i < n; i++)
         {
-            out << "#include <cstdint>\n#include <cstddef>\n#include <string_view>\n\n";
-            if (enable_simd)
+            if (starts[i] >= limit_off)
             {
-                out << "#include <type_traits>\n#include <utility>\n\n";
+                out.next = base + starts[i];
+                return;
             }
-            out << inc << "\n\n";
+            out.toks.kinds.push_back(kinds[i]);
+            out.toks.starts.push_back(base + starts[i]);
+            out.toks.ends.push_back(base + ends[i]);
+        }
+        if (n < block)
+        {
+            out.next = base + static_cast<std::size_t>(src.cursor() - from);
+            out.ended = true;
+            return;
         }
+    }
+}
 
-        auto simd_states = enable_simd ? find_simd_states(dfa) : std::unordered_map<int64_t, std::vector<char>>{};
-        if (dfa.emit_prelude && enable_simd)
+// Lexes every chunk speculatively from the DFA's start state, then stitches the chunks together in order: a chunk is taken from
+// the token where it agrees with the stream so far (both scanners restarted at the same offset, so they match from there on),
+// and re-lexed from the stream's own boundary when no such token exists.
+template <typename Source, typename Ctx, typename Batch>
+auto run(Batch batch, const char* begin, const char* end, unsigned nthreads, const Ctx& ctx, tokens& out) -> std::size_t
+{
+    constexpr std::size_t min_chunk = std::size_t{1} << 16;
+    const auto size = static_cast<std::size_t>(end - begin);
+    const auto count = std::max<std::size_t>(1, std::min<std::size_t>(nthreads, size / min_chunk));
+
+    // chunks start at a newline, where the grammar resynchronizes
+    std::vector<const char*> bounds(count + 1, end);
+    bounds[0] = begin;
+    for (std::size_t k = 1; k < count; k++)
+    {
+        const char* split = std::max(begin + (size / count * k), bounds[k - 1]);
+        const auto* nl = static_cast<const char*>(std::memchr(split, '\n', static_cast<std::size_t>(end - split)));
+        bounds[k] = nl != nullptr ? nl : end;
+    }
+
+    std::vector<chunk> chunks(count);
+    std::vector<std::thread> workers;
+    workers.reserve(count - 1);
+    for (std::size_t k = 1; k < count; k++)
+    {
+        workers.emplace_back([&, k] { lex_chunk<Source>(batch, begin, bounds[k], bounds[k + 1], end, ctx, chunks[k]); });
+    }
+    lex_chunk<Source>(batch, begin, begin, bounds[1], end, ctx, chunks[0]);
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    append(out, chunks[0].toks, 0);
+    std::size_t next = chunks[0].next;
+    bool ended = chunks[0].ended;
+    for (std::size_t k = 1; k < count && !ended; k++)
+    {
+        if (next >= static_cast<std::size_t>(bounds[k + 1] - begin))
         {
-            emit_simd_prelude(out);
+            continue;
         }
 
-        auto class_expr = emit_c_family_classifier(out, dfa, "src.peek()", true);
+        const auto& spec = chunks[k];
+        auto it = std::lower_bound(spec.toks.starts.begin(), spec.toks.starts.end(), next);
+        if (it != spec.toks.starts.end() && *it == next)
+        {
+            append(out, spec.toks, static_cast<std::size_t>(it - spec.toks.starts.begin()));
+        }
+        else if (spec.next != next)
+        {
+            chunk redo;
+            lex_chunk<Source>(batch, begin, begin + next, bounds[k + 1], end, ctx, redo);
+            append(out, redo.toks, 0);
+            next = redo.next;
+            ended = redo.ended;
+            continue;
+        }
+        next = spec.next;
+        ended = spec.ended;
+    }
+    return next;
+}
 
-        out << "template <typename Source, typename Ctx>\n";
-        out << std::format("[[gnu::always_inline]] inline auto {}(Source& src, Ctx& ctx)\n{{\n", dfa.fn_name);
-        out << "    (void)ctx;\n";
-        out << "    int64_t latest_match = -1;\n";
-        out << "\n    src.start_token();\n";
-        out << "    [[maybe_unused]] std::size_t start_bytes = src.bytes();\n\n";
-        out << std::format("    goto STATE_{};\n\n", dfa.start_state);
+} // namespace lexgen_parallel
+#endif
 
-        std::size_t total_cases = 0;
+)cpp";
+    }
 
-        for (int64_t state = 0; state < static_cast<int64_t>(dfa.state_count); state++)
+    void emit_incremental_prelude(std::ostream& out)
+    {
+        out << R"cpp(#ifndef LEXGEN_INCREMENTAL_DEFINED
+#define LEXGEN_INCREMENTAL_DEFINED
+#include <algorithm>
+#include <concepts>
+#include <iterator>
+#include <vector>
+namespace lexgen_incremental {
+
+// where lexing can restart: the token index, its byte offset (the end of the token before it) and the Ctx there
+template <typename Ctx>
+struct checkpoint
+{
+    std::size_t token;
+    std::size_t offset;
+    Ctx ctx;
+};
+
+template <typename Ctx>
+struct document
+{
+    std::vector<uint32_t> kinds;
+    std::vector<std::size_t> starts;
+    std::vector<std::size_t> ends;
+    // per token: the furthest offset read while scanning it or any token before it (the end if it read EOF)
+    std::vector<std::size_t> reaches;
+    std::vector<checkpoint<Ctx>> checkpoints;
+    std::size_t stop = 0; // where lexing stopped: the end, or input no rule matches
+};
+
+// `removed` bytes at `start` were replaced by `inserted` new ones
+struct edit
+{
+    std::size_t start;
+    std::size_t removed;
+    std::size_t inserted;
+};
+
+// tokens [first, first + removed) were replaced by [first, first + inserted)
+struct change
+{
+    std::size_t first;
+    std::size_t removed;
+    std::size_t inserted;
+};
+
+inline constexpr std::size_t checkpoint_every = 64;
+
+// Ctx is the only scanner state kept between tokens; one without operator== is assumed to never change what gets lexed
+template <typename Ctx>
+auto same_state(const Ctx& a, const Ctx& b) -> bool
+{
+    if constexpr (std::equality_comparable<Ctx>)
+    {
+        return a == b;
+    }
+    else
+    {
+        return true;
+    }
+}
+
+// Re-lexes from the last checkpoint whose tokens never read into the edit, and splices the result in as soon as it reaches a
+// checkpoint past the edit at the same offset with the same Ctx: from there on the old tokens are what lexing would produce, so they
+// are only shifted. Checkpoints are recorded every `checkpoint_every` tokens, so an edit costs about that many tokens of lexing.
+template <typename Source, typename Ctx, typename Batch>
+auto relex(Batch batch, const char* begin, const char* end, const edit& e, document<Ctx>& doc) -> change
+{
+    const auto delta = static_cast<std::ptrdiff_t>(e.inserted) - static_cast<std::ptrdiff_t>(e.removed);
+    const std::size_t old_edit_end = e.start + e.removed;
+    const auto shift = [delta](std::size_t offset) { return static_cast<std::size_t>(static_cast<std::ptrdiff_t>(offset) + delta); };
+
+    // reaches only grow, and a token that read up to the edit's first byte may change
+    const auto safe = static_cast<std::size_t>(std::ranges::partition_point(doc.reaches, [&](std::size_t r) { return r < e.start; }) - doc.reaches.begin());
+    const auto from = static_cast<std::size_t>(
+        std::ranges::upper_bound(doc.checkpoints, safe, {}, [](const checkpoint<Ctx>& c) { return c.token; }) - doc.checkpoints.begin() - 1
+    );
+    const std::size_t first = doc.checkpoints[from].token;
+    std::size_t target = static_cast<std::size_t>(
+        std::ranges::lower_bound(doc.checkpoints.begin() + static_cast<std::ptrdiff_t>(from) + 1, doc.checkpoints.end(), old_edit_end, {},
+                                 [](const checkpoint<Ctx>& c) { return c.offset; })
+        - doc.checkpoints.begin()
+    );
+
+    document<Ctx> fresh;
+    Ctx ctx = doc.checkpoints[from].ctx;
+    std::size_t pos = doc.checkpoints[from].offset;
+    std::size_t reach = first > 0 ? doc.reaches[first - 1] : 0;
+    Source src(begin + pos, end);
+    const auto base = pos;
+
+    uint32_t kinds[checkpoint_every];
+    std::size_t starts[checkpoint_every];
+    std::size_t ends[checkpoint_every];
+    std::size_t reaches[checkpoint_every];
+    std::size_t old_tokens = doc.kinds.size();
+    bool synced = false;
+    for (;;)
+    {
+        while (target < doc.checkpoints.size() && shift(doc.checkpoints[target].offset) < pos)
         {
-            out << std::format("STATE_{}:\n", state);
+            target++;
+        }
+        if (target < doc.checkpoints.size() && shift(doc.checkpoints[target].offset) == pos && same_state(ctx, doc.checkpoints[target].ctx))
+        {
+            old_tokens = doc.checkpoints[target].token;
+            synced = true;
+            break;
+        }
 
-            if (auto simd_it = simd_states.find(state); simd_it != simd_states.end())
+        fresh.checkpoints.push_back({first + fresh.kinds.size(), pos, ctx});
+        std::size_t n = batch(src, ctx, kinds, starts, ends, reaches, checkpoint_every);
+
+        // a token ending on the target: stop the block there, so the next round sees the Ctx at that boundary
+        std::size_t capacity = checkpoint_every;
+        if (target < doc.checkpoints.size())
+        {
+            const auto* hit = std::find(ends, ends + n, shift(doc.checkpoints[target].offset) - base);
+            if (hit + 1 < ends + n)
             {
-                out << "    if constexpr (lexgen_simd::has_bulk_scan<Source>::value)\n    {\n";
-                out << "        auto simd_span = src.remaining();\n";
-                out << "        auto simd_n = lexgen_simd::scan_safe_run<";
-                for (std::size_t i = 0; i < simd_it->second.size(); i++)
-                {
-                    if (i != 0)
-                    {
-                        out << ", ";
-                    }
-                    out << "(char)" << static_cast<int>(static_cast<unsigned char>(simd_it->second[i]));
-                }
-                out << ">(simd_span.data(), simd_span.size());\n";
-                out << "        if (simd_n > 0) { src.skip(simd_n); }\n    }\n";
+                capacity = static_cast<std::size_t>(hit - ends) + 1;
+                ctx = fresh.checkpoints.back().ctx;
+                src.commit(begin + pos, begin + pos);
+                n = batch(src, ctx, kinds, starts, ends, reaches, capacity);
             }
+        }
 
-            if (dfa.end_bitmask[state])
+        for (std::size_t i = 0; i < n; i++)
+        {
+            reach = std::max(reach, base + reaches[i]);
+            fresh.kinds.push_back(kinds[i]);
+            fresh.starts.push_back(base + starts[i]);
+            fresh.ends.push_back(base + ends[i]);
+            fresh.reaches.push_back(reach);
+        }
+        pos = base + static_cast<std::size_t>(src.cursor() - (begin + base));
+        if (n < capacity)
+        {
+            break;
+        }
+    }
+
+    const auto at = [](auto& v, std::size_t i) { return v.begin() + static_cast<std::ptrdiff_t>(i); };
+    const change result{first, old_tokens - first, fresh.kinds.size()};
+
+    // the old tail is only shifted; its reaches before the edit stay put
+    for (std::size_t i = old_tokens; i < doc.kinds.size(); i++)
+    {
+        doc.starts[i] = shift(doc.starts[i]);
+        doc.ends[i] = shift(doc.ends[i]);
+        reach = std::max(reach, doc.reaches[i] >= old_edit_end ? shift(doc.reaches[i]) : doc.reaches[i]);
+        doc.reaches[i] = reach;
+    }
+    const auto tail_checkpoints = synced ? target : doc.checkpoints.size();
+    for (std::size_t i = tail_checkpoints; i < doc.checkpoints.size(); i++)
+    {
+        doc.checkpoints[i].token = doc.checkpoints[i].token - old_tokens + first + fresh.kinds.size();
+        doc.checkpoints[i].offset = shift(doc.checkpoints[i].offset);
+    }
+
+    const auto splice = [&](auto& v, const auto& with) { v.insert(v.erase(at(v, first), at(v, old_tokens)), with.begin(), with.end()); };
+    splice(doc.kinds, fresh.kinds);
+    splice(doc.starts, fresh.starts);
+    splice(doc.ends, fresh.ends);
+    splice(doc.reaches, fresh.reaches);
+    doc.checkpoints.erase(at(doc.checkpoints, from), at(doc.checkpoints, tail_checkpoints));
+    doc.checkpoints.insert(at(doc.checkpoints, from), std::make_move_iterator(fresh.checkpoints.begin()), std::make_move_iterator(fresh.checkpoints.end()));
+    doc.stop = synced ? shift(doc.stop) : pos;
+    return result;
+}
+
+template <typename Source, typename Ctx, typename Batch>
+void lex(Batch batch, const char* begin, const char* end, const Ctx& ctx, document<Ctx>& doc)
+{
+    doc = document<Ctx>{};
+    doc.checkpoints.push_back({0, 0, ctx});
+    relex<Source>(batch, begin, end, edit{0, 0, static_cast<std::size_t>(end - begin)}, doc);
+}
+
+} // namespace lexgen_incremental
+#endif
+
+)cpp";
+    }
+
+    // Decodes one codepoint and classifies it. ASCII skips both the decoding and the trie walk, since it's the bulk of most input (and,
+    // with --simd, all that a self-loop hands back after a bulk scan besides its stop bytes).
+    void emit_c_family_utf8_body(std::ostream& out, std::string_view prefix, std::string_view read_expr, bool is_cpp)
+    {
+        out << std::format("    uint32_t b0 = {};\n", read_expr);
+        out << (is_cpp ? std::format("    if (b0 < 0x{:X}) [[likely]] return {}CP_STAGE3[b0];\n", CP_ASCII_END, prefix)
+                       : std::format("    if (LEXGEN_C_LIKELY(b0 < 0x{:X})) return {}CP_STAGE3[b0];\n", CP_ASCII_END, prefix));
+        out << "    int extra; uint32_t cp;\n";
+        out << "    if ((b0 & 0xE0) == 0xC0) { extra = 1; cp = b0 & 0x1F; }\n";
+        out << "    else if ((b0 & 0xF0) == 0xE0) { extra = 2; cp = b0 & 0x0F; }\n";
+        out << "    else if ((b0 & 0xF8) == 0xF0) { extra = 3; cp = b0 & 0x07; }\n";
+        out << std::format("    else return {}classify_cp(0xFFFD);\n", prefix);
+        out << "    for (int i = 0; i < extra; i++)\n    {\n";
+        out << std::format("        uint32_t bn = {};\n", read_expr);
+        out << std::format("        if ((bn & 0xC0) != 0x80) return {}classify_cp(0xFFFD);\n", prefix);
+        out << "        cp = (cp << 6) | (bn & 0x3F);\n";
+        out << "    }\n";
+        out << std::format("    return {}classify_cp(cp);\n", prefix);
+        out << "}\n\n";
+    }
+
+    auto emit_c_family_classifier(std::ostream& out, const dfa_view& dfa, std::string_view peek_expr, bool is_cpp) -> std::string
+    {
+        const auto prefix = std::string(dfa.fn_name) + "_";
+
+        if (!needs_unicode_decode(dfa))
+        {
+            std::vector<uint32_t> byte_classes;
+            for (int cp = 0; cp < 256; cp++)
             {
-                out << std::format("    latest_match = {};\n    src.accept();\n", dfa.end_to_nfa_state[state]);
+                byte_classes.push_back(static_cast<uint32_t>(dfa.classes.classify(static_cast<uint32_t>(cp))));
+            }
+            out << std::format("static const {} {}BYTE_CLASS[256] = {{", c_table_type(byte_classes), prefix);
+            for (auto value : byte_classes)
+            {
+                out << value << ",";
             }
+            out << "};\n\n";
+            return std::format("{}BYTE_CLASS[(unsigned char){}]", prefix, peek_expr);
+        }
 
-            auto groups = build_class_groups(dfa, state);
-            if (groups.empty())
+        auto trie = build_codepoint_trie(dfa.classes);
+        for (const auto& [name, table] : {std::pair{"STAGE1", &trie.stage1}, std::pair{"STAGE2", &trie.stage2}, std::pair{"STAGE3", &trie.stage3}})
+        {
+            out << std::format("static const {} {}CP_{}[{}] = {{", c_table_type(*table), prefix, name, table->size());
+            for (auto value : *table)
             {
-                out << "    goto FAIL;\n\n";
-                continue;
+                out << value << ",";
             }
+            out << "};\n";
+        }
+        out << "\n";
+
+        if (!is_cpp)
+        {
+            out << "#ifndef LEXGEN_C_LIKELY\n#if defined(__GNUC__) || defined(__clang__)\n#define LEXGEN_C_LIKELY(x) __builtin_expect(!!(x), 1)\n";
+            out << "#else\n#define LEXGEN_C_LIKELY(x) (x)\n#endif\n#endif\n\n";
+        }
+
+        // `cp` always comes from the decoders, so it's within the trie's domain
+        out << std::format("static int64_t {}classify_cp(uint32_t cp)\n{{\n", prefix);
+        out << std::format(
+            "    return {0}CP_STAGE3[{0}CP_STAGE2[{0}CP_STAGE1[cp >> {1}] + ((cp >> {2}) & 0x{3:X})] + (cp & 0x{4:X})];\n", prefix, CP_STAGE1_SHIFT,
+            CP_STAGE3_SHIFT, (1U << (CP_STAGE1_SHIFT - CP_STAGE3_SHIFT)) - 1, (1U << CP_STAGE3_SHIFT) - 1
+        );
+        out << "}\n\n";
+
+        out
+            << (is_cpp ? std::format("template <typename Source>\nstatic int64_t {}classify_utf8(Source& src)\n{{\n", prefix)
+                       : std::format("static int64_t {}classify_utf8(Source *src)\n{{\n", prefix));
+        emit_c_family_utf8_body(out, prefix, std::format("(unsigned char){}", peek_expr), is_cpp);
+
+        return std::format("{}classify_utf8(src)", prefix);
+    }
+
+    // Same classes as emit_c_family_classifier, but reading through the register-resident `p`/`raw_end` pair instead of peeking the
+    // Source; the BYTE_CLASS table (if any) has already been emitted by it. Byte reads are unchecked: in sentinel mode the NUL at
+    // `raw_end` always ends the run, and otherwise each state tests for the end before its switch (see raw_eof_check). The codepoint
+    // decoder keeps its own checks because a truncated sequence may run into the end (or consume the sentinel).
+    auto emit_raw_classifier(std::ostream& out, const dfa_view& dfa, bool is_cpp) -> std::string
+    {
+        const auto prefix = std::string(dfa.fn_name) + "_";
+
+        if (!needs_unicode_decode(dfa))
+        {
+            return std::format("{}BYTE_CLASS[(unsigned char)*p++]", prefix);
+        }
+
+        const char* cursor = is_cpp ? "p" : "(*pp)";
+        out
+            << (is_cpp ? std::format("static inline int64_t {}classify_utf8_raw(const char*& p, const char* raw_end)\n{{\n", prefix)
+                       : std::format("static int64_t {}classify_utf8_raw(const char** pp, const char* raw_end)\n{{\n", prefix));
+        emit_c_family_utf8_body(out, prefix, std::format("{0} < raw_end ? (unsigned char)*{0}++ : 0", cursor), is_cpp);
+
+        return std::format("{}classify_utf8_raw({}, raw_end)", prefix, is_cpp ? "p" : "&p");
+    }
+
+    // Whether the raw scanner has to test `p == raw_end` itself before reading a byte: the byte classifier reads unchecked, and only a
+    // sentinel makes that safe.
+    auto raw_eof_check(const dfa_view& dfa, bool sentinel) -> bool { return !sentinel && !needs_unicode_decode(dfa); }
+
+    // `zero_class_fixup` is emitted in front of the goto for the class containing byte 0, so it only runs on (possible) EOF transitions;
+    // `newline_fixup` likewise for the class containing '\n'. With `eof_check`, reaching `raw_end` takes the transition on byte 0 without
+    // reading (EOF reads as 0 forever), so only that test is left on the path of every byte.
+    auto emit_goto_switch(
+        std::ostream& out, const dfa_view& dfa, int64_t state, std::string_view class_expr, std::string_view label_prefix,
+        std::string_view zero_class_fixup = "", std::string_view newline_fixup = "", bool eof_check = false
+    ) -> std::size_t
+    {
+        auto groups = build_class_groups(dfa, state);
+        if (groups.empty())
+        {
+            out << std::format("    goto {}FAIL;\n\n", label_prefix);
+            return 0;
+        }
+
+        if (eof_check)
+        {
+            const auto eof_class = dfa.classes.classify(0);
+            auto eof_target =
+                std::ranges::find_if(groups, [&](const auto& group) { return std::ranges::find(group.second, eof_class) != group.second.end(); });
+            out << std::format(
+                "    if (p == raw_end) {{ goto {}{}; }}\n", label_prefix,
+                eof_target == groups.end() ? std::string("FAIL") : std::format("STATE_{}", eof_target->first)
+            );
+        }
+
+        const auto zero_class = zero_class_fixup.empty() ? int64_t{-1} : dfa.classes.classify(0);
+        const auto newline_class = newline_fixup.empty() ? int64_t{-1} : dfa.classes.classify('\n');
+
+        std::size_t cases = 0;
+        out << std::format("    switch ({})\n    {{\n", class_expr);
+        for (const auto& [target, class_ids] : groups)
+        {
+            // the plain labels share one goto; it has to come before the fixup cases, or they would fall through into them
+            bool any = false;
+            for (auto class_id : class_ids)
+            {
+                if (class_id != zero_class && class_id != newline_class)
+                {
+                    out << std::format("    case {}: ", class_id);
+                    any = true;
+                }
+            }
+            if (any)
+            {
+                out << std::format("goto {}STATE_{};\n", label_prefix, target);
+            }
+            for (auto class_id : class_ids)
+            {
+                cases++;
+                if (class_id == zero_class || class_id == newline_class)
+                {
+                    out << std::format(
+                        "    case {}: {}{} goto {}STATE_{};\n", class_id, class_id == zero_class ? zero_class_fixup : "",
+                        class_id == newline_class ? newline_fixup : "", label_prefix, target
+                    );
+                }
+            }
+        }
+        out << std::format("    default: goto {}FAIL;\n    }}\n\n", label_prefix);
+        return cases;
+    }
+
+    // Byte b stops the run iff bit (b >> 4) & 7 of rows[(b & 0x0F) | (b & 0x80) >> 3] is set, see lexgen_simd::scan_set_run.
+    auto nibble_rows(const std::vector<char>& stops) -> std::vector<unsigned>
+    {
+        std::vector<unsigned> rows(32, 0);
+        for (auto stop : stops)
+        {
+            auto byte = static_cast<unsigned char>(stop);
+            rows[(byte & 0x0FU) | ((byte & 0x80U) >> 3)] |= 1U << ((byte >> 4) & 7U);
+        }
+        return rows;
+    }
+
+    // Inclusive ranges of the bytes not in `stops`, or nothing if there are more than SWAR_MAX_RANGES of them.
+    auto safe_ranges(const std::vector<char>& stops) -> std::vector<std::pair<unsigned, unsigned>>
+    {
+        std::array<bool, 256> stop{};
+        for (auto byte : stops)
+        {
+            stop[static_cast<unsigned char>(byte)] = true;
+        }
+
+        std::vector<std::pair<unsigned, unsigned>> ranges;
+        for (unsigned byte = 0; byte < 256; byte++)
+        {
+            if (stop[byte])
+            {
+                continue;
+            }
+            if (!ranges.empty() && ranges.back().second + 1 == byte)
+            {
+                ranges.back().second = byte;
+            }
+            else
+            {
+                ranges.emplace_back(byte, byte);
+            }
+        }
+
+        if (ranges.size() > SWAR_MAX_RANGES)
+        {
+            ranges.clear();
+        }
+        return ranges;
+    }
+
+    // The lexgen_simd kernel (with template arguments) that skips over bytes not in `stops`.
+    auto simd_scan_fn(const std::vector<char>& stops) -> std::string
+    {
+        std::string args;
+        if (stops.size() <= SIMD_MAX_STOP_BYTES)
+        {
+            for (auto stop : stops)
+            {
+                args += std::format("{}(char){}", args.empty() ? "" : ", ", static_cast<int>(static_cast<unsigned char>(stop)));
+            }
+            return std::format("lexgen_simd::scan_safe_run<{}>", args);
+        }
+
+        std::string bounds;
+        for (auto [lo, hi] : safe_ranges(stops))
+        {
+            bounds += std::format("{}{}, {}", bounds.empty() ? "" : ", ", lo, hi);
+        }
+        for (auto row : nibble_rows(stops))
+        {
+            args += std::format("{}{}", args.empty() ? "" : ", ", row);
+        }
+        return std::format("lexgen_simd::scan_set_run<lexgen_simd::byte_ranges<{}>, {}>", bounds, args);
+    }
+
+    // Body for Sources implementing the raw cursor protocol: `p`, `mark` (end of the latest match) and `tok` live in locals for the whole
+    // token and are only written back through commit right before the handler runs. `simd_calls` maps a state to the bulk-scan call
+    // advancing `p`.
+    // whether '\n' is the only codepoint in its equivalence class, so taking that class's transition means a newline was read
+    auto newline_only_class(const dfa_view& dfa) -> bool
+    {
+        auto newline_class = dfa.classes.classify('\n');
+        if (newline_class >= static_cast<int64_t>(dfa.classes.class_count()))
+        {
+            return false;
+        }
+        auto interval = dfa.classes.class_interval(newline_class);
+        return interval.lo == '\n' && interval.hi == '\n';
+    }
+
+    // Where an accepting state sets `mark`: the cursor, except for `/r/s/` rules, whose token ends at the end of r
+    auto accept_mark(const dfa_view& dfa, int64_t nfa_state) -> std::string
+    {
+        auto cut_it = dfa.trailing_rules.find(nfa_state);
+        if (cut_it == dfa.trailing_rules.end())
+        {
+            return "mark = p;";
+        }
+        switch (cut_it->second.cut)
+        {
+        case lexergen::trailing_cut::kind::TAIL:
+            return std::format("mark = p - {};", cut_it->second.length);
+        case lexergen::trailing_cut::kind::HEAD:
+            return std::format("mark = tok + {};", cut_it->second.length);
+        case lexergen::trailing_cut::kind::MARK:
+            break;
+        }
+        return std::format("mark = trail_{};", nfa_state);
+    }
+
+    // The `trail_<n>` locals of the MARK rules, set on entering a state where their r can end (emit_trail_marks). A rule that never wins
+    // (another rule takes all its matches) still gets one, set but never read, so they are marked unused.
+    void emit_trail_locals(std::ostream& out, const dfa_view& dfa, bool is_cpp)
+    {
+        std::vector<int64_t> marked;
+        for (const auto& [nfa_state, cut] : dfa.trailing_rules)
+        {
+            if (cut.cut == lexergen::trailing_cut::kind::MARK)
+            {
+                marked.push_back(nfa_state);
+            }
+        }
+        std::ranges::sort(marked);
+        for (auto nfa_state : marked)
+        {
+            out << (is_cpp ? std::format("    [[maybe_unused]] const char* trail_{} = p;\n", nfa_state)
+                           : std::format("    const char* trail_{0} = p;\n    (void)trail_{0};\n", nfa_state));
+        }
+    }
+
+    void emit_trail_marks(std::ostream& out, const dfa_view& dfa, int64_t state)
+    {
+        if (dfa.trail_marks.empty())
+        {
+            return;
+        }
+        for (auto nfa_state : dfa.trail_marks[static_cast<std::size_t>(state)])
+        {
+            out << std::format("    trail_{} = p;\n", nfa_state);
+        }
+    }
+
+    // With `track_lines` (cpp only) the scanner also keeps the line number and line start in locals, bumped on '\n' transitions and saved
+    // along with `mark` on accepting states, and stores them in the Source with the cursor. Handlers see `start_line`/`start_column`.
+    void emit_raw_locals(std::ostream& out, bool is_cpp, bool track_lines)
+    {
+        if (is_cpp)
+        {
+            out << "    const char* const raw_begin = src.begin();\n";
+            out << "    const char* const raw_end = src.end();\n";
+            out << "    const char* p = src.cursor();\n";
+            out << "    [[maybe_unused]] std::size_t start_bytes = static_cast<std::size_t>(p - raw_begin);\n";
+        }
+        else
+        {
+            out << "    const char* const raw_begin = Source_begin(src);\n";
+            out << "    const char* const raw_end = Source_end(src);\n";
+            out << "    const char* p = Source_cursor(src);\n";
+            out << "    size_t start_bytes = (size_t)(p - raw_begin);\n";
+            out << "    (void)start_bytes;\n";
+        }
+        out << "    const char* tok = p;\n";
+        out << "    const char* mark = p;\n";
+        if (track_lines)
+        {
+            out << "    std::size_t line = src.line();\n";
+            out << "    const char* line_start = raw_begin + src.line_start();\n";
+            out << "    std::size_t mark_line = line;\n";
+            out << "    const char* mark_line_start = line_start;\n";
+            out << "    [[maybe_unused]] std::size_t start_line = line;\n";
+            out << "    [[maybe_unused]] std::size_t start_column = static_cast<std::size_t>(p - line_start) + 1;\n";
+        }
+        out << "\n";
+    }
+
+    // The states of one raw-cursor scanner, labelled `<label_prefix>STATE_n`; they leave through `<label_prefix>FAIL`. With
+    // dfa.memo_states (--linear) those states first check the memo, giving up on a pair that already failed, and accepting states
+    // clear what the scan has visited.
+    auto emit_raw_states(
+        std::ostream& out, const dfa_view& dfa, std::string_view class_expr, const std::unordered_map<int64_t, std::string>& simd_calls,
+        bool sentinel, bool track_lines, std::string_view label_prefix
+    ) -> std::size_t
+    {
+        std::unordered_map<int64_t, std::size_t> memo_slots;
+        for (std::size_t slot = 0; slot < dfa.memo_states.size(); slot++)
+        {
+            memo_slots[dfa.memo_states[slot]] = slot;
+        }
+
+        // reading the sentinel moves `p` one past `raw_end`; pull it back so EOF keeps reading as 0 forever and tokens never include it
+        const auto fixup = sentinel && !needs_unicode_decode(dfa) ? std::string_view("if (p > raw_end) { p = raw_end; }") : std::string_view();
+        const auto newline_fixup = !track_lines ? std::string()
+                                   : newline_only_class(dfa) ? std::string("++line; line_start = p;")
+                                                             : std::string("if (p[-1] == '\\n') { ++line; line_start = p; }");
+
+        std::size_t total_cases = 0;
+
+        for (int64_t state = 0; state < static_cast<int64_t>(dfa.state_count); state++)
+        {
+            out << std::format("{}STATE_{}:\n", label_prefix, state);
+
+            // a SIMD skip would jump over positions without checking or recording them, so memoized states go byte by byte
+            auto slot_it = memo_slots.find(state);
+            if (slot_it != memo_slots.end())
+            {
+                out << std::format("    if (memo.seen(p, {})) {{ goto {}FAIL; }}\n", slot_it->second, label_prefix);
+                out << std::format("    memo.visit(p, {});\n", slot_it->second);
+            }
+            else if (auto simd_it = simd_calls.find(state); simd_it != simd_calls.end())
+            {
+                out << std::format("    p += {};\n", simd_it->second);
+            }
+
+            emit_trail_marks(out, dfa, state);
+
+            if (dfa.end_bitmask[state])
+            {
+                out << std::format("    latest_match = {};\n    {}\n", dfa.end_to_nfa_state[state], accept_mark(dfa, dfa.end_to_nfa_state[state]));
+                if (track_lines)
+                {
+                    out << "    mark_line = line;\n    mark_line_start = line_start;\n";
+                }
+                if (!memo_slots.empty())
+                {
+                    out << "    memo.accept();\n";
+                }
+            }
+
+            total_cases += emit_goto_switch(out, dfa, state, class_expr, label_prefix, fixup, newline_fixup, raw_eof_check(dfa, sentinel));
+        }
+
+        return total_cases;
+    }
+
+    // What follows the FAIL label: commit the longest match and run its handler (or the UNKNOWN one). A handler that falls through resets
+    // the locals for the next token and runs `restart`, a goto back to a start state.
+    void emit_raw_tail(
+        std::ostream& out, const std::unordered_map<int64_t, std::string>& handler_map, std::string_view handle_error,
+        std::string_view handle_internal_error, bool is_cpp, bool track_lines, std::string_view restart
+    )
+    {
+        out << (is_cpp ? "    src.commit(tok, mark);\n" : "    Source_commit(src, tok, mark);\n");
+        if (track_lines)
+        {
+            out << "    src.set_line(mark_line, static_cast<std::size_t>(mark_line_start - raw_begin));\n";
+        }
+        out << "    if (latest_match == -1)\n    {\n";
+        out << "        " << handle_error << "\n";
+        out << "    }\n\n";
+        out << "    {\n";
+        out << (is_cpp ? "        [[maybe_unused]] std::string_view buffer = src.text();\n" : "        lex_text buffer = Source_text(src);\n        (void)buffer;\n");
+        out << "        switch (latest_match)\n        {\n";
+
+        for (const auto& [nfa_state, handler] : handler_map)
+        {
+            out << std::format("        case {}: {}\n", nfa_state, handler);
+        }
+
+        out << "        default:\n            " << handle_internal_error << "\n";
+        out << "        }\n    }\n\n";
+
+        out << "    latest_match = -1;\n";
+        out << (is_cpp ? "    p = tok = mark = src.cursor();\n" : "    p = tok = mark = Source_cursor(src);\n");
+        out << (is_cpp ? "    start_bytes = static_cast<std::size_t>(tok - raw_begin);\n" : "    start_bytes = (size_t)(tok - raw_begin);\n");
+        if (track_lines)
+        {
+            out << "    line = mark_line = start_line = src.line();\n";
+            out << "    line_start = mark_line_start = raw_begin + src.line_start();\n";
+            out << "    start_column = static_cast<std::size_t>(tok - line_start) + 1;\n";
+        }
+        out << "    " << restart << "\n";
+    }
+
+    auto emit_raw_body(
+        std::ostream& out, const dfa_view& dfa, std::string_view class_expr, const std::unordered_map<int64_t, std::string>& simd_calls,
+        const std::string& handle_error, const std::string& handle_internal_error, bool is_cpp, bool sentinel, bool track_lines = false
+    ) -> std::size_t
+    {
+        const auto restart = std::format("goto RAW_STATE_{};", dfa.start_state);
+
+        emit_raw_locals(out, is_cpp, track_lines);
+        emit_trail_locals(out, dfa, is_cpp);
+        if (!dfa.memo_states.empty())
+        {
+            out << std::format("    memo.bind(raw_begin, raw_end, {}, \"{}\");\n", dfa.memo_states.size(), dfa.fn_name);
+        }
+        out << "    " << restart << "\n\n";
+        auto total_cases = emit_raw_states(out, dfa, class_expr, simd_calls, sentinel, track_lines, "RAW_");
+        out << "RAW_FAIL:\n";
+        if (!dfa.memo_states.empty())
+        {
+            out << "    memo.fail();\n";
+        }
+        emit_raw_tail(out, dfa.handler_map, handle_error, handle_internal_error, is_cpp, track_lines, restart);
+        return total_cases;
+    }
+
+    auto is_bare_break(std::string_view handler) -> bool
+    {
+        auto start = handler.find_first_not_of(" \t\r");
+        auto end = handler.find_last_not_of(" \t\r");
+        return start != std::string_view::npos && handler.substr(start, end - start + 1) == "break;";
+    }
+
+    // lex_batch: the raw-cursor scanner again, but accepting states record the rule id itself, so the per-token tail stores
+    // (rule, start, end) and loops without committing to the Source or dispatching through the handler switch. Only rules marked
+    // for it run their handler (and store nothing). Stops early at EOF (the zero-length match there) or where no rule matches,
+    // leaving the Source at that token so a lex_tok call can report it. With `track_reach` (cpp only) it also fills a `reaches` array:
+    // how far scanning each token, and the skipped tokens before it, read ahead, which tells lexgen_incremental what an edit can affect.
+    auto emit_raw_batch(
+        std::ostream& out, const dfa_view& dfa, std::string_view batch_fn_name, std::string_view class_expr,
+        const std::unordered_map<int64_t, std::string>& simd_calls, bool is_cpp, bool sentinel, bool track_reach = false
+    ) -> std::size_t
+    {
+        const auto fixup = sentinel && !needs_unicode_decode(dfa) ? std::string_view("if (p > raw_end) { p = raw_end; }") : std::string_view();
+
+        if (is_cpp)
+        {
+            out << "template <typename Source, typename Ctx>\n";
+            out << std::format(
+                "inline std::size_t {}(Source& src, Ctx& ctx, uint32_t* kinds, std::size_t* starts, std::size_t* ends, {}std::size_t capacity)\n{{\n",
+                batch_fn_name, track_reach ? "std::size_t* reaches, " : ""
+            );
+            out << std::format(
+                "    static_assert(lexgen_raw::has_raw_cursor<Source>::value, \"{} needs a Source with begin()/cursor()/end()/commit()\");\n",
+                batch_fn_name
+            );
+            out << "    (void)ctx;\n";
+            out << "    const char* const raw_begin = src.begin();\n";
+            out << "    const char* const raw_end = src.end();\n";
+            out << "    const char* p = src.cursor();\n";
+            out << "    [[maybe_unused]] std::size_t start_bytes = static_cast<std::size_t>(p - raw_begin);\n";
+            out << "    std::size_t count = 0;\n";
+        }
+        else
+        {
+            out << std::format(
+                "static size_t {}(Source *src, Ctx *ctx, uint32_t *kinds, size_t *starts, size_t *ends, size_t capacity)\n{{\n", batch_fn_name
+            );
+            out << "    (void)ctx;\n";
+            out << "    const char* const raw_begin = Source_begin(src);\n";
+            out << "    const char* const raw_end = Source_end(src);\n";
+            out << "    const char* p = Source_cursor(src);\n";
+            out << "    size_t start_bytes = (size_t)(p - raw_begin);\n";
+            out << "    (void)start_bytes;\n";
+            out << "    size_t count = 0;\n";
+        }
+        // TOKEN rules store their token kind rather than their rule id (the switch below still dispatches on rule ids)
+        const bool kind_table = !dfa.token_rules.empty();
+        if (kind_table)
+        {
+            std::vector<int64_t> kinds(dfa.rule_ids.size());
+            for (const auto& [nfa_state, rule] : dfa.rule_ids)
+            {
+                auto token_it = dfa.token_rules.find(nfa_state);
+                kinds[static_cast<std::size_t>(rule)] = token_it != dfa.token_rules.end() ? token_it->second : rule;
+            }
+            out << (is_cpp ? "    static constexpr uint32_t batch_kinds[] = {" : "    static const uint32_t batch_kinds[] = {");
+            for (std::size_t i = 0; i < kinds.size(); i++)
+            {
+                out << (i == 0 ? "" : ", ") << kinds[i];
+            }
+            out << "};\n";
+        }
+        out << "    int64_t latest_rule = -1;\n";
+        out << "    const char* tok = p;\n";
+        out << "    const char* mark = p;\n";
+        if (track_reach)
+        {
+            out << "    const char* reach = p;\n";
+        }
+        emit_trail_locals(out, dfa, is_cpp);
+        out << "    if (capacity == 0) return 0;\n\n";
+        out << std::format("    goto BATCH_STATE_{};\n\n", dfa.start_state);
+
+        std::size_t total_cases = 0;
+
+        for (int64_t state = 0; state < static_cast<int64_t>(dfa.state_count); state++)
+        {
+            out << std::format("BATCH_STATE_{}:\n", state);
+
+            if (auto simd_it = simd_calls.find(state); simd_it != simd_calls.end())
+            {
+                out << std::format("    p += {};\n", simd_it->second);
+            }
+
+            emit_trail_marks(out, dfa, state);
+
+            if (dfa.end_bitmask[state])
+            {
+                out << std::format(
+                    "    latest_rule = {};\n    {}\n", dfa.rule_ids.at(dfa.end_to_nfa_state[state]), accept_mark(dfa, dfa.end_to_nfa_state[state])
+                );
+            }
+
+            total_cases += emit_goto_switch(out, dfa, state, class_expr, "BATCH_", fixup, "", raw_eof_check(dfa, sentinel));
+        }
+
+        const auto* commit_tok = is_cpp ? "src.commit(tok, tok);" : "Source_commit(src, tok, tok);";
+        const auto* commit_mark = is_cpp ? "src.commit(mark, mark);" : "Source_commit(src, mark, mark);";
+
+        out << "BATCH_FAIL:\n";
+        if (track_reach)
+        {
+            // `p` is one past the byte that stopped the scan, or still at the end if that was EOF
+            out << "    if (p > reach) { reach = p; }\n";
+        }
+        out << std::format("    if (latest_rule == -1 || mark == tok) {{ {} return count; }}\n", commit_tok);
+
+        // handled rules, in declaration order so the emitted switch is stable; a bare `break;` handler (whitespace, comments) needs
+        // neither the commit nor the dispatch, so those just restart the scan
+        std::vector<std::pair<int64_t, int64_t>> handled;
+        std::vector<int64_t> skipped;
+        for (auto nfa_state : dfa.batch_handlers)
+        {
+            if (is_bare_break(dfa.handler_map.at(nfa_state)))
+            {
+                skipped.push_back(dfa.rule_ids.at(nfa_state));
+                continue;
+            }
+            handled.emplace_back(dfa.rule_ids.at(nfa_state), nfa_state);
+        }
+        std::ranges::sort(handled);
+        std::ranges::sort(skipped);
+
+        if (!handled.empty() || !skipped.empty())
+        {
+            out << "    switch (latest_rule)\n    {\n";
+            for (auto rule : skipped)
+            {
+                out << std::format("    case {}:\n", rule);
+            }
+            if (!skipped.empty())
+            {
+                out << "        latest_rule = -1;\n        p = tok = mark;\n";
+                out << std::format("        goto BATCH_STATE_{};\n", dfa.start_state);
+            }
+            for (const auto& [rule, nfa_state] : handled)
+            {
+                out << std::format("    case {}:\n", rule);
+            }
+            if (!handled.empty())
+            {
+                out << "        goto BATCH_HANDLE;\n";
+            }
+            out << "    default:\n        break;\n    }\n";
+        }
+
+        out << (kind_table ? "    kinds[count] = batch_kinds[latest_rule];\n" : "    kinds[count] = (uint32_t)latest_rule;\n");
+        out << "    starts[count] = (size_t)(tok - raw_begin);\n";
+        out << "    ends[count] = (size_t)(mark - raw_begin);\n";
+        if (track_reach)
+        {
+            out << "    reaches[count] = (size_t)(reach - raw_begin);\n";
+            out << "    reach = mark;\n";
+        }
+        out << std::format("    if (++count == capacity) {{ {} return count; }}\n", commit_mark);
+        out << "    latest_rule = -1;\n";
+        out << "    p = tok = mark;\n";
+        out << std::format("    goto BATCH_STATE_{};\n\n", dfa.start_state);
+
+        if (!handled.empty())
+        {
+            out << "BATCH_HANDLE:\n";
+            out << (is_cpp ? "    src.commit(tok, mark);\n" : "    Source_commit(src, tok, mark);\n");
+            out << (is_cpp ? "    start_bytes = static_cast<std::size_t>(tok - raw_begin);\n" : "    start_bytes = (size_t)(tok - raw_begin);\n");
+            out << "    {\n";
+            out << (is_cpp ? "        [[maybe_unused]] std::string_view buffer = src.text();\n"
+                           : "        lex_text buffer = Source_text(src);\n        (void)buffer;\n");
+            out << "        switch (latest_rule)\n        {\n";
+            for (const auto& [rule, nfa_state] : handled)
+            {
+                out << std::format("        case {}: {}\n", rule, dfa.handler_map.at(nfa_state));
+            }
+            out << "        default:\n            break;\n";
+            out << "        }\n    }\n";
+            out << "    latest_rule = -1;\n";
+            out << (is_cpp ? "    p = tok = mark = src.cursor();\n" : "    p = tok = mark = Source_cursor(src);\n");
+            out << std::format("    goto BATCH_STATE_{};\n", dfa.start_state);
+        }
+
+        out << "}\n\n";
+        return total_cases;
+    }
+
+    void emit_push_prelude(std::ostream& out)
+    {
+        out << R"cpp(#ifndef LEXGEN_PUSH_DEFINED
+#define LEXGEN_PUSH_DEFINED
+#include <string>
+namespace lexgen_push {
+
+// Input of a push-mode lexer, handed over one chunk at a time. When a token runs off the end of a chunk, the lexer parks its DFA
+// state here along with the token's bytes so far, and resumes from that state on the next chunk.
+class stream
+{
+public:
+    // [begin, end) must stay valid until the lexer asks for more again (which also means it's done with the previous chunk)
+    void feed(const char* begin, const char* end)
+    {
+        chunk_offset += static_cast<std::size_t>(chunk_end - chunk_begin);
+        chunk_begin = cur = begin;
+        chunk_end = end;
+    }
+
+    // no more chunks: the lexer matches EOF where the input ends instead of asking for more
+    void finish()
+    {
+        if (cur == chunk_end)
+        {
+            feed(nullptr, nullptr);
+        }
+        eof = true;
+    }
+
+    // valid until the next call into the lexer
+    [[nodiscard]] auto text() const -> std::string_view { return text_; }
+
+    [[nodiscard]] auto bytes() const -> std::size_t { return bytes_; }
+
+    // Moves the scan to absolute `offset`. Past the start of the chunk that's a pointer into it; otherwise `offset` lies within the
+    // carried bytes of the token, which are copied in front of the rest of the chunk so they can be scanned again.
+    auto seek(std::size_t offset) -> const char*
+    {
+        if (offset >= chunk_offset)
+        {
+            return chunk_begin + (offset - chunk_offset);
+        }
+        replay.assign(carry, offset - tok_offset);
+        replay.append(chunk_begin, chunk_end);
+        chunk_begin = replay.data();
+        chunk_end = chunk_begin + replay.size();
+        chunk_offset = offset;
+        return chunk_begin;
+    }
+
+    // whether the last call ran out of input (and so returned through NEED_MORE) rather than matching a token
+    [[nodiscard]] auto needs_more() const -> bool { return need_more; }
+
+    // out of input for good: the last call matched EOF (or failed) at the very end
+    [[nodiscard]] auto exhausted() const -> bool { return eof && cur == chunk_end && state == -1 && text_.empty(); }
+
+    // scan state, owned by the generated lexer
+    bool need_more = false;
+    int64_t state = -1;            // DFA state to resume in, -1 to start a new token
+    int64_t latest_match = -1;
+    std::size_t tok_offset = 0;    // absolute offset of the token being scanned
+    std::size_t mark_offset = 0;   // absolute end of its latest match
+    std::string carry;             // its bytes from earlier chunks, [tok_offset, chunk_offset)
+    const char* chunk_begin = nullptr;
+    const char* chunk_end = nullptr;
+    const char* cur = nullptr;
+    std::size_t chunk_offset = 0;
+    bool eof = false;
+    std::string_view text_;
+    std::size_t bytes_ = 0;
+
+private:
+    std::string replay;
+};
+
+} // namespace lexgen_push
+#endif
+
+)cpp";
+    }
+
+    // Push mode: the raw-cursor scanner over the current chunk of a lexgen_push::stream, with a check at every state that reads input.
+    // Running out of input there saves the state and the token's bytes so far and runs the NEED_MORE handler; the next call jumps
+    // straight back to that state. `tok`/`mark` point into the chunk, or are null while they still lie in an earlier one.
+    void emit_push(
+        std::ostream& out, const dfa_view& dfa, std::string_view push_fn_name, std::string_view class_expr,
+        const std::unordered_map<int64_t, std::string>& simd_calls, const std::string& handle_error, const std::string& handle_internal_error,
+        std::string_view handle_need_more
+    )
+    {
+        out << "template <typename Ctx>\n";
+        out << std::format("inline auto {}(lexgen_push::stream& src, Ctx& ctx)\n{{\n", push_fn_name);
+        out << "    (void)ctx;\n";
+        out << "    src.need_more = false;\n";
+        out << "    const char* p = src.cur;\n";
+        out << "    const char* raw_end = src.chunk_end;\n";
+        out << "    const char* tok = nullptr;\n";
+        out << "    const char* mark = nullptr;\n";
+        out << "    int64_t latest_match = src.latest_match;\n";
+        out << "    [[maybe_unused]] std::size_t start_bytes = src.tok_offset;\n\n";
+
+        out << "    switch (src.state)\n    {\n";
+        for (int64_t state = 0; state < static_cast<int64_t>(dfa.state_count); state++)
+        {
+            if (!build_class_groups(dfa, state).empty())
+            {
+                out << std::format("    case {0}: goto PUSH_STATE_{0};\n", state);
+            }
+        }
+        out << "    default: break;\n    }\n\n";
+
+        out << "PUSH_START:\n";
+        out << "    src.carry.clear();\n";
+        out << "    latest_match = -1;\n";
+        out << "    tok = mark = p;\n";
+        out << "    start_bytes = src.chunk_offset + static_cast<std::size_t>(p - src.chunk_begin);\n";
+        out << std::format("    goto PUSH_STATE_{};\n\n", dfa.start_state);
+
+        for (int64_t state = 0; state < static_cast<int64_t>(dfa.state_count); state++)
+        {
+            out << std::format("PUSH_STATE_{}:\n", state);
+
+            if (auto simd_it = simd_calls.find(state); simd_it != simd_calls.end())
+            {
+                out << std::format("    p += {};\n", simd_it->second);
+            }
+
+            if (dfa.end_bitmask[state])
+            {
+                out << std::format("    latest_match = {};\n    mark = p;\n", dfa.end_to_nfa_state[state]);
+            }
+
+            if (!build_class_groups(dfa, state).empty())
+            {
+                out << std::format("    if (p == raw_end && !src.eof) [[unlikely]] {{ src.state = {}; goto PUSH_NEED_MORE; }}\n", state);
+            }
+            emit_goto_switch(out, dfa, state, class_expr, "PUSH_", "", "", raw_eof_check(dfa, false));
+        }
+
+        out << "PUSH_NEED_MORE:\n";
+        out << "    if (p == tok)\n    {\n        src.state = -1;\n    }\n";
+        out << "    src.carry.append(tok != nullptr ? tok : src.chunk_begin, raw_end);\n";
+        out << "    if (mark != nullptr)\n    {\n";
+        out << "        src.mark_offset = src.chunk_offset + static_cast<std::size_t>(mark - src.chunk_begin);\n    }\n";
+        out << "    src.latest_match = latest_match;\n";
+        out << "    src.tok_offset = start_bytes;\n";
+        out << "    src.feed(raw_end, raw_end);\n";
+        out << "    src.need_more = true;\n";
+        out << "    " << handle_need_more << "\n\n";
+
+        out << "PUSH_FAIL:\n";
+        out << "    src.state = -1;\n";
+        out << "    if (latest_match == -1)\n    {\n";
+        out << "        p = tok != nullptr ? tok : src.seek(start_bytes);\n";
+        out << "        raw_end = src.chunk_end;\n";
+        out << "        src.cur = p;\n";
+        out << "        src.text_ = {};\n";
+        out << "        src.bytes_ = start_bytes;\n";
+        out << "        " << handle_error << "\n";
+        out << "    }\n\n";
+        out << "    if (tok != nullptr)\n    {\n";
+        out << "        src.text_ = std::string_view(tok, static_cast<std::size_t>(mark - tok));\n";
+        out << "        p = mark;\n";
+        out << "    }\n";
+        out << "    else if (mark != nullptr)\n    {\n";
+        out << "        src.carry.append(src.chunk_begin, mark);\n";
+        out << "        src.text_ = src.carry;\n";
+        out << "        p = mark;\n";
+        out << "    }\n";
+        out << "    else\n    {\n";
+        out << "        p = src.seek(src.mark_offset);\n";
+        out << "        raw_end = src.chunk_end;\n";
+        out << "        src.text_ = std::string_view(src.carry).substr(0, src.mark_offset - start_bytes);\n";
+        out << "    }\n";
+        out << "    src.cur = p;\n";
+        out << "    src.bytes_ = start_bytes + src.text_.size();\n";
+        out << "    {\n";
+        out << "        [[maybe_unused]] std::string_view buffer = src.text();\n";
+        out << "        switch (latest_match)\n        {\n";
+        for (const auto& [nfa_state, handler] : dfa.handler_map)
+        {
+            out << std::format("        case {}: {}\n", nfa_state, handler);
+        }
+        out << "        default:\n            " << handle_internal_error << "\n";
+        out << "        }\n    }\n";
+        out << "    goto PUSH_START;\n";
+        out << "}\n\n";
+    }
+
+    void emit_coroutine_prelude(std::ostream& out)
+    {
+        out << R"cpp(#ifndef LEXGEN_CORO_DEFINED
+#define LEXGEN_CORO_DEFINED
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+namespace lexgen_coro {
+
+// What `co_await value` ends up waiting on: the result of a member or free operator co_await if there is one, else the value itself
+template <typename Awaitable>
+decltype(auto) awaiter_of(Awaitable&& value)
+{
+    if constexpr (requires { std::forward<Awaitable>(value).operator co_await(); })
+    {
+        return std::forward<Awaitable>(value).operator co_await();
+    }
+    else if constexpr (requires { operator co_await(std::forward<Awaitable>(value)); })
+    {
+        return operator co_await(std::forward<Awaitable>(value));
+    }
+    else
+    {
+        return std::forward<Awaitable>(value);
+    }
+}
+
+// `co_await src.refill()` hands over the next chunk of input, empty once there is no more; it must stay valid until the next refill
+template <typename Source>
+concept async_source = requires(Source& src) {
+    { lexgen_coro::awaiter_of(src.refill()).await_resume() } -> std::convertible_to<std::string_view>;
+};
+
+// A lexer coroutine yielding tokens to whoever awaits next(); in between it may itself be suspended on its source's refill().
+template <typename Token>
+class token_stream
+{
+public:
+    struct promise_type;
+    using handle = std::coroutine_handle<promise_type>;
+
+    // Hands the token yielded (or nothing, once the lexer has finished) to whoever waits in next(): by returning into next() when it
+    // resumed the lexer itself, or by resuming the consumer when the lexer was woken up by its source instead.
+    struct hand_back
+    {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle h) noexcept
+        {
+            return h.promise().inline_resume ? std::noop_coroutine() : h.promise().consumer;
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type
+    {
+        std::optional<Token> current;
+        std::coroutine_handle<> consumer = std::noop_coroutine();
+        bool inline_resume = false;
+        std::exception_ptr error;
+
+        auto get_return_object() -> token_stream { return token_stream(handle::from_promise(*this)); }
+        auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+        auto final_suspend() noexcept -> hand_back { return {}; }
+        auto yield_value(Token token) -> hand_back
+        {
+            current = std::move(token);
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    explicit token_stream(handle h) : coro(h) {}
+    token_stream(token_stream&& other) noexcept : coro(std::exchange(other.coro, {})) {}
+    token_stream(const token_stream&) = delete;
+    auto operator=(token_stream other) noexcept -> token_stream&
+    {
+        std::swap(coro, other.coro);
+        return *this;
+    }
+    ~token_stream()
+    {
+        if (coro)
+        {
+            coro.destroy();
+        }
+    }
+
+    // `co_await next()`: the next token, or nullopt after the last one
+    auto next()
+    {
+        struct awaiter
+        {
+            handle coro;
+            bool await_ready() noexcept { return coro.done(); }
+            // the consumer stays suspended only if the lexer is now waiting for input
+            bool await_suspend(std::coroutine_handle<> consumer)
+            {
+                auto& promise = coro.promise();
+                promise.consumer = consumer;
+                promise.current.reset();
+                promise.inline_resume = true;
+                coro.resume();
+                promise.inline_resume = false;
+                return !promise.current && !coro.done();
+            }
+            auto await_resume() -> std::optional<Token>
+            {
+                if (auto error = std::exchange(coro.promise().error, nullptr))
+                {
+                    std::rethrow_exception(error);
+                }
+                return coro.done() ? std::nullopt : std::move(coro.promise().current);
+            }
+        };
+        return awaiter{coro};
+    }
+
+private:
+    handle coro;
+};
+
+} // namespace lexgen_coro
+#endif
+
+)cpp";
+    }
+
+    void emit_cpp_prelude(std::ostream& out, const std::string& inc, const lexergen::codegen_options& options)
+    {
+        out << "#include <cstdint>\n#include <cstddef>\n#include <string_view>\n#include <type_traits>\n#include <utility>\n\n";
+        out << inc << "\n\n";
+        emit_token_types(out, lexergen::target_lang::CPP, options.token_kinds);
+        emit_raw_cursor_prelude(out);
+        if (options.enable_simd)
+        {
+            emit_simd_prelude(out);
+        }
+        if (options.linear)
+        {
+            emit_linear_prelude(out);
+        }
+    }
+
+    // The raw-cursor bulk skip for each SIMD state. With `count_lines`, a skip over a run that may contain newlines counts them afterwards.
+    auto make_raw_simd_calls(const std::unordered_map<int64_t, std::vector<char>>& simd_states, bool count_lines)
+        -> std::unordered_map<int64_t, std::string>
+    {
+        std::unordered_map<int64_t, std::string> calls;
+        for (const auto& [state, stops] : simd_states)
+        {
+            auto call = std::format("{}(p, static_cast<std::size_t>(raw_end - p))", simd_scan_fn(stops));
+            if (count_lines && std::ranges::find(stops, '\n') == stops.end())
+            {
+                call = std::format("lexgen_simd::count_lines(p, {}, line, line_start)", call);
+            }
+            calls[state] = std::move(call);
+        }
+        return calls;
+    }
+
+    // The generic (peek/accept) scanner's states and tail, the counterparts of emit_raw_states/emit_raw_tail for Sources without a raw
+    // cursor.
+    auto emit_peek_states(
+        std::ostream& out, const dfa_view& dfa, std::string_view class_expr, const std::unordered_map<int64_t, std::vector<char>>& simd_states,
+        std::string_view label_prefix
+    ) -> std::size_t
+    {
+        std::size_t total_cases = 0;
+
+        for (int64_t state = 0; state < static_cast<int64_t>(dfa.state_count); state++)
+        {
+            out << std::format("{}STATE_{}:\n", label_prefix, state);
+
+            if (auto simd_it = simd_states.find(state); simd_it != simd_states.end())
+            {
+                out << "    if constexpr (lexgen_simd::has_bulk_scan<Source>::value)\n    {\n";
+                out << "        auto simd_span = src.remaining();\n";
+                out << std::format("        auto simd_n = {}(simd_span.data(), simd_span.size());\n", simd_scan_fn(simd_it->second));
+                out << "        if (simd_n > 0) { src.skip(simd_n); }\n    }\n";
+            }
+
+            if (dfa.end_bitmask[state])
+            {
+                out << std::format("    latest_match = {};\n    src.accept();\n", dfa.end_to_nfa_state[state]);
+            }
+
+            total_cases += emit_goto_switch(out, dfa, state, class_expr, label_prefix);
+        }
+
+        return total_cases;
+    }
+
+    void emit_peek_tail(
+        std::ostream& out, const std::unordered_map<int64_t, std::string>& handler_map, std::string_view handle_error,
+        std::string_view handle_internal_error, std::string_view restart
+    )
+    {
+        out << "    if (latest_match == -1)\n    {\n";
+        out << "        " << handle_error << "\n";
+        out << "    }\n\n";
+        out << "    src.backtrack();\n";
+        out << "    {\n";
+        out << "        [[maybe_unused]] std::string_view buffer = src.text();\n";
+        out << "        switch (latest_match)\n        {\n";
+
+        for (const auto& [nfa_state, handler] : handler_map)
+        {
+            out << std::format("        case {}: {}\n", nfa_state, handler);
+        }
+
+        out << "        default:\n            " << handle_internal_error << "\n";
+        out << "        }\n    }\n\n";
+
+        out << "    latest_match = -1;\n";
+        out << "    src.start_token();\n";
+        out << "    start_bytes = src.bytes();\n";
+        out << "    " << restart << "\n";
+    }
+
+    auto emit_cpp(
+        std::ostream& out, const dfa_view& dfa, const std::string& inc, const std::string& handle_error, const std::string& handle_internal_error,
+        const lexergen::codegen_options& options
+    ) -> lexergen::codegen_result
+    {
+        if (dfa.emit_prelude)
+        {
+            emit_cpp_prelude(out, inc, options);
+        }
+
+        auto simd_states = options.enable_simd ? find_simd_states(dfa) : std::unordered_map<int64_t, std::vector<char>>{};
+        auto class_expr = emit_c_family_classifier(out, dfa, "src.peek()", true);
+        auto raw_class_expr = emit_raw_classifier(out, dfa, true);
+        auto raw_simd_calls = make_raw_simd_calls(simd_states, false);
+
+        if (!options.batch_fn_name.empty())
+        {
+            emit_raw_batch(out, dfa, options.batch_fn_name, raw_class_expr, raw_simd_calls, true, options.sentinel);
+        }
+
+        if (!options.parallel_fn_name.empty())
+        {
+            emit_parallel_prelude(out);
+            out << "template <typename Source, typename Ctx>\n";
+            out << std::format(
+                "inline std::size_t {}(const char* begin, const char* end, unsigned nthreads, const Ctx& ctx, lexgen_parallel::tokens& out)\n{{\n",
+                options.parallel_fn_name
+            );
+            out << "    auto batch = [](Source& src, Ctx& chunk_ctx, uint32_t* kinds, std::size_t* starts, std::size_t* ends, std::size_t capacity)\n";
+            out << std::format("    {{ return {}(src, chunk_ctx, kinds, starts, ends, capacity); }};\n", options.batch_fn_name);
+            out << "    return lexgen_parallel::run<Source>(batch, begin, end, nthreads, ctx, out);\n}\n\n";
+        }
+
+        if (!options.incremental_fn_name.empty())
+        {
+            const auto scan_fn_name = std::string(options.incremental_fn_name) + "_scan";
+            emit_raw_batch(out, dfa, scan_fn_name, raw_class_expr, raw_simd_calls, true, options.sentinel, true);
+            emit_incremental_prelude(out);
+            out << "template <typename Source, typename Ctx>\n";
+            out << std::format(
+                "inline void {}(const char* begin, const char* end, const Ctx& ctx, lexgen_incremental::document<Ctx>& doc)\n{{\n",
+                options.incremental_fn_name
+            );
+            out << std::format("    lexgen_incremental::lex<Source>({}<Source, Ctx>, begin, end, ctx, doc);\n}}\n\n", scan_fn_name);
+            out << "template <typename Source, typename Ctx>\n";
+            out << std::format(
+                "inline auto {}(const char* begin, const char* end, const lexgen_incremental::edit& edit, lexgen_incremental::document<Ctx>& doc) "
+                "-> lexgen_incremental::change\n{{\n",
+                options.incremental_fn_name
+            );
+            out << std::format("    return lexgen_incremental::relex<Source>({}<Source, Ctx>, begin, end, edit, doc);\n}}\n\n", scan_fn_name);
+        }
+
+        if (!options.push_fn_name.empty())
+        {
+            emit_push_prelude(out);
+            emit_push(out, dfa, options.push_fn_name, raw_class_expr, raw_simd_calls, handle_error, handle_internal_error, options.handle_need_more);
+        }
+
+        if (!options.stream_fn_name.empty())
+        {
+            // lex_push until it runs dry, then suspend on the source's refill; no suspension point is per byte or per token
+            emit_coroutine_prelude(out);
+            out << "template <lexgen_coro::async_source Source, typename Ctx>\n";
+            out << std::format(
+                "auto {}(Source& src, Ctx& ctx) -> lexgen_coro::token_stream<decltype({}(std::declval<lexgen_push::stream&>(), ctx))>\n{{\n",
+                options.stream_fn_name, options.push_fn_name
+            );
+            out << "    lexgen_push::stream input;\n";
+            out << "    for (;;)\n    {\n";
+            out << std::format("        auto token = {}(input, ctx);\n", options.push_fn_name);
+            out << "        if (input.needs_more())\n        {\n";
+            out << "            std::string_view chunk = co_await src.refill();\n";
+            out << "            if (chunk.empty())\n            {\n                input.finish();\n            }\n";
+            out << "            else\n            {\n                input.feed(chunk.data(), chunk.data() + chunk.size());\n            }\n";
+            out << "            continue;\n        }\n";
+            out << "        const bool last = input.exhausted();\n";
+            out << "        co_yield std::move(token);\n";
+            out << "        if (last)\n        {\n            co_return;\n        }\n";
+            out << "    }\n}\n\n";
+        }
+
+        out << "template <typename Source, typename Ctx>\n";
+        out << std::format(
+            "[[gnu::always_inline]] inline auto {}(Source& src, Ctx& ctx{})\n{{\n", dfa.fn_name, options.linear ? ", lexgen_linear::memo& memo" : ""
+        );
+        out << "    (void)ctx;\n";
+        if (options.linear && dfa.memo_states.empty())
+        {
+            // every rescan is bounded already, so the memo isn't needed
+            out << "    (void)memo;\n";
+        }
+        out << "    int64_t latest_match = -1;\n\n";
+
+        // trailing context moves `mark` back behind the cursor, which a peek Source's accept() can't do; the memo is keyed by pointer
+        if (options.sentinel || options.track_lines || options.linear || !dfa.trailing_rules.empty())
+        {
+            out << std::format(
+                "    static_assert(lexgen_raw::has_raw_cursor<Source>::value, \"{} needs a Source with begin()/cursor()/end()/commit()\");\n",
+                options.sentinel ? "--sentinel" : options.track_lines ? "--track-lines" : options.linear ? "--linear" : "trailing context"
+            );
+
+            auto total_cases = emit_raw_body(
+                out, dfa, raw_class_expr, make_raw_simd_calls(simd_states, options.track_lines), handle_error, handle_internal_error, true,
+                options.sentinel, options.track_lines
+            );
+            out << "}\n";
+            return {.state_count = dfa.state_count, .case_count = total_cases};
+        }
+
+        out << "    if constexpr (lexgen_raw::has_raw_cursor<Source>::value)\n    {\n";
+        emit_raw_body(out, dfa, raw_class_expr, raw_simd_calls, handle_error, handle_internal_error, true, false);
+        out << "    }\n    else\n    {\n";
+        out << "        src.start_token();\n";
+        out << "        [[maybe_unused]] std::size_t start_bytes = src.bytes();\n\n";
+        const auto restart = std::format("goto STATE_{};", dfa.start_state);
+        out << "        " << restart << "\n\n";
+        auto total_cases = emit_peek_states(out, dfa, class_expr, simd_states, "");
+        out << "FAIL:\n";
+        emit_peek_tail(out, dfa.handler_map, handle_error, handle_internal_error, restart);
+        out << "    }\n";
+        out << "}\n";
+
+        return {.state_count = dfa.state_count, .case_count = total_cases};
+    }
+
+    // One STATE of the merged lex_tok, as emit_cpp_states lays it out
+    struct state_view
+    {
+        std::string_view name;
+        dfa_view dfa;
+        const std::string& handle_error;
+        const std::string& handle_internal_error;
+    };
+
+    void emit_state_types(std::ostream& out, std::span<const state_view> states, bool state_actions)
+    {
+        out << "enum class lex_state_id : uint32_t\n{\n";
+        for (std::size_t i = 0; i < states.size(); i++)
+        {
+            out << std::format("    {} = {},\n", states[i].name, i);
+        }
+        out << "};\n\n";
+        if (!state_actions)
+        {
+            return;
+        }
+
+        out << R"cpp(// The STATE lex_tok scans the next token in, plus the stack PUSH()/POP() keep. Fixed-size: a PUSH() past `depth` still switches
+// STATE but doesn't save the current one, and a POP() with nothing saved returns to INITIAL; either sets `overflowed`, since from
+// then on the STATEs no longer follow the input's nesting.
+struct lex_states
+{
+    static constexpr std::size_t depth = 32;
+
+    lex_state_id current = lex_state_id::INITIAL;
+    lex_state_id saved[depth]{};
+    std::size_t size = 0;
+    bool overflowed = false;
+
+    void begin(lex_state_id state) { current = state; }
+
+    void push(lex_state_id state)
+    {
+        if (size < depth)
+        {
+            saved[size++] = current;
+        }
+        else
+        {
+            overflowed = true;
+        }
+        current = state;
+    }
+
+    void pop()
+    {
+        if (size > 0)
+        {
+            current = saved[--size];
+        }
+        else
+        {
+            overflowed = true;
+            current = lex_state_id::INITIAL;
+        }
+    }
+};
+
+)cpp";
+    }
+
+    // Every token, the first one included, starts at `<label_prefix>DISPATCH`, which jumps to the start state of the current STATE's DFA.
+    void emit_state_dispatch(std::ostream& out, std::span<const state_view> states, std::string_view state_expr, std::string_view label_prefix)
+    {
+        out << std::format("{}DISPATCH:\n", label_prefix);
+        out << std::format("    switch ({})\n    {{\n", state_expr);
+        for (std::size_t i = 0; i < states.size(); i++)
+        {
+            out << std::format("    case lex_state_id::{}:\n", states[i].name);
+            if (i == 0)
+            {
+                out << "    default:\n";
+            }
+            out << std::format("        goto {}S{}_STATE_{};\n", label_prefix, i, states[i].dfa.start_state);
+        }
+        out << "    }\n\n";
+    }
+
+    // The UNKNOWN (or ERROR) handler of the shared tail: the common one when the STATEs agree, else a switch on the current STATE
+    auto per_state_handler(std::span<const state_view> states, std::string_view state_expr, bool internal_error) -> std::string
+    {
+        auto handler_of = [&](const state_view& state) -> const std::string&
+        { return internal_error ? state.handle_internal_error : state.handle_error; };
+        if (std::ranges::all_of(states, [&](const auto& state) { return handler_of(state) == handler_of(states[0]); }))
+        {
+            return handler_of(states[0]);
+        }
+
+        auto result = std::format("switch ({})\n        {{\n", state_expr);
+        for (const auto& state : states)
+        {
+            result += std::format("        case lex_state_id::{}: {}\n", state.name, handler_of(state));
+        }
+        return result + "        }";
+    }
+
+    // All STATEs in a single lex_tok. The DFAs keep their own states under per-STATE labels, but their accepting states are numbered
+    // apart so they all leave through one FAIL tail and handler switch, and share a class table when codegen_states could merge them.
+    // With `state_actions` it takes the lex_states that handlers' BEGIN/PUSH/POP update, and a handler that falls through (a skipped
+    // token) goes back to the dispatch, so it continues in the STATE it just switched to without returning; otherwise it takes the
+    // lex_state_id to lex in.
+    auto emit_cpp_states(
+        std::ostream& out, std::span<const state_view> states, const std::string& inc, const lexergen::codegen_options& options
+    ) -> lexergen::codegen_result
+    {
+        const auto state_expr = options.state_actions ? std::string_view("lex_state.current") : std::string_view("state");
+
+        emit_cpp_prelude(out, inc, options);
+        emit_state_types(out, states, options.state_actions);
+
+        struct state_exprs
+        {
+            std::unordered_map<int64_t, std::vector<char>> simd_states;
+            std::string class_expr;
+            std::string raw_class_expr;
+        };
+
+        std::vector<state_exprs> exprs;
+        std::unordered_map<int64_t, std::string> handlers;
+        std::size_t state_count = 0;
+        for (const auto& state : states)
+        {
+            auto simd_states = options.enable_simd ? find_simd_states(state.dfa) : std::unordered_map<int64_t, std::vector<char>>{};
+            if (!exprs.empty() && &state.dfa.classes == &states[0].dfa.classes)
+            {
+                exprs.push_back({std::move(simd_states), exprs[0].class_expr, exprs[0].raw_class_expr});
+            }
+            else
+            {
+                auto class_expr = emit_c_family_classifier(out, state.dfa, "src.peek()", true);
+                exprs.push_back({std::move(simd_states), std::move(class_expr), emit_raw_classifier(out, state.dfa, true)});
+            }
+            handlers.insert(state.dfa.handler_map.begin(), state.dfa.handler_map.end());
+            state_count += state.dfa.state_count;
+        }
+        const auto handle_error = per_state_handler(states, state_expr, false);
+        const auto handle_internal_error = per_state_handler(states, state_expr, true);
+
+        out << "template <typename Source, typename Ctx>\n";
+        out << std::format(
+            "[[gnu::always_inline]] inline auto {}(Source& src, Ctx& ctx, {})\n{{\n", states[0].dfa.fn_name,
+            options.state_actions ? "lex_states& lex_state" : "lex_state_id state"
+        );
+        out << "    (void)ctx;\n";
+        out << "    int64_t latest_match = -1;\n\n";
+
+        auto emit_raw_states_all = [&](bool sentinel, bool track_lines)
+        {
+            std::size_t cases = 0;
+            emit_raw_locals(out, true, track_lines);
+            for (const auto& state : states)
+            {
+                emit_trail_locals(out, state.dfa, true);
+            }
+            emit_state_dispatch(out, states, state_expr, "RAW_");
+            for (std::size_t i = 0; i < states.size(); i++)
+            {
+                cases += emit_raw_states(
+                    out, states[i].dfa, exprs[i].raw_class_expr, make_raw_simd_calls(exprs[i].simd_states, track_lines), sentinel, track_lines,
+                    std::format("RAW_S{}_", i)
+                );
+            }
+            for (std::size_t i = 0; i < states.size(); i++)
+            {
+                out << std::format("RAW_S{}_FAIL:\n", i);
+            }
+            emit_raw_tail(out, handlers, handle_error, handle_internal_error, true, track_lines, "goto RAW_DISPATCH;");
+            return cases;
+        };
+
+        const bool trailing = std::ranges::any_of(states, [](const state_view& state) { return !state.dfa.trailing_rules.empty(); });
+        if (options.sentinel || options.track_lines || trailing)
+        {
+            out << std::format(
+                "    static_assert(lexgen_raw::has_raw_cursor<Source>::value, \"{} needs a Source with begin()/cursor()/end()/commit()\");\n",
+                options.sentinel ? "--sentinel" : options.track_lines ? "--track-lines" : "trailing context"
+            );
+            auto total_cases = emit_raw_states_all(options.sentinel, options.track_lines);
+            out << "}\n";
+            return {.state_count = state_count, .case_count = total_cases};
+        }
+
+        out << "    if constexpr (lexgen_raw::has_raw_cursor<Source>::value)\n    {\n";
+        emit_raw_states_all(false, false);
+        out << "    }\n    else\n    {\n";
+        out << "        src.start_token();\n";
+        out << "        [[maybe_unused]] std::size_t start_bytes = src.bytes();\n\n";
+        emit_state_dispatch(out, states, state_expr, "");
+
+        std::size_t total_cases = 0;
+        for (std::size_t i = 0; i < states.size(); i++)
+        {
+            total_cases += emit_peek_states(out, states[i].dfa, exprs[i].class_expr, exprs[i].simd_states, std::format("S{}_", i));
+        }
+        for (std::size_t i = 0; i < states.size(); i++)
+        {
+            out << std::format("S{}_FAIL:\n", i);
+        }
+        emit_peek_tail(out, handlers, handle_error, handle_internal_error, "goto DISPATCH;");
+        out << "    }\n";
+        out << "}\n";
+
+        return {.state_count = state_count, .case_count = total_cases};
+    }
+
+    void emit_c_simd_prelude(std::ostream& out)
+    {
+        out << R"c(#ifndef LEXGEN_C_SIMD_DEFINED
+#define LEXGEN_C_SIMD_DEFINED
+/* Same tiers and runtime dispatch as the C++ lexgen_simd prelude: GCC/Clang on x86 also build AVX2/AVX-512BW kernels with target
+ * attributes and pick one from CPUID at startup; define LEXGEN_SIMD_NO_DISPATCH to only use the -m flags. Without x86 SIMD,
+ * GCC/Clang generic vectors run, then the portable SWAR tier; define LEXGEN_SIMD_FORCE_SWAR to use SWAR everywhere. */
+#if !defined(LEXGEN_SIMD_FORCE_SWAR)
+#if defined(__AVX512BW__)
+#define LEXGEN_C_SIMD_HAS_AVX512BW 1
+#endif
+#if defined(__AVX2__)
+#define LEXGEN_C_SIMD_HAS_AVX2 1
+#endif
+#if defined(__SSE4_2__)
+#define LEXGEN_C_SIMD_HAS_SSE42 1
+#endif
+#if defined(__SSSE3__)
+#define LEXGEN_C_SIMD_HAS_SSSE3 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LEXGEN_C_SIMD_HAS_SSE2 1
+#endif
+#if !defined(LEXGEN_SIMD_NO_DISPATCH) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LEXGEN_C_SIMD_DISPATCH 1
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(LEXGEN_C_SIMD_HAS_SSE2)
+#define LEXGEN_C_SIMD_HAS_VECTOR_EXT 1
+#endif
+#endif
+#if defined(LEXGEN_C_SIMD_DISPATCH)
+#define LEXGEN_C_SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define LEXGEN_C_SIMD_TARGET(isa)
+#endif
+#if defined(LEXGEN_C_SIMD_HAS_AVX512BW) || defined(LEXGEN_C_SIMD_DISPATCH)
+#define LEXGEN_C_SIMD_AVX512BW 1
+#endif
+#if (defined(LEXGEN_C_SIMD_HAS_AVX2) && !defined(LEXGEN_C_SIMD_HAS_AVX512BW)) || defined(LEXGEN_C_SIMD_DISPATCH)
+#define LEXGEN_C_SIMD_AVX2 1
+#endif
+
+#if defined(LEXGEN_C_SIMD_AVX512BW) || defined(LEXGEN_C_SIMD_AVX2)
+#include <immintrin.h>
+#elif defined(LEXGEN_C_SIMD_HAS_SSE42)
+#include <nmmintrin.h>
+#elif defined(LEXGEN_C_SIMD_HAS_SSSE3)
+#include <tmmintrin.h>
+#elif defined(LEXGEN_C_SIMD_HAS_SSE2)
+#include <emmintrin.h>
+#endif
+#include <string.h>
+
+#if defined(_MSC_VER)
+#define LEXGEN_C_ALIGN16 __declspec(align(16))
+#else
+#define LEXGEN_C_ALIGN16 __attribute__((aligned(16)))
+#endif
+
+/* Stop sets come in two kinds. eq: up to 8 stop bytes (zero-padded to 16 for cmpestri), folded with one compare each; count is a
+ * constant once the kernel is inlined into its per-state wrapper, so the unused compares drop out. set: 32 nibble rows, where
+ * rows[lo | (hi & 8) << 1] has bit (hi & 7) set when byte (hi << 4 | lo) stops the run, followed by `count` inclusive ranges of the
+ * bytes that continue it (lo, hi pairs) for the SWAR tier. */
+#define LEXGEN_C_EQ_FOLD(acc, combine, compare, count) \
+    acc = compare(0); \
+    if ((count) > 1) { acc = combine(acc, compare(1)); } \
+    if ((count) > 2) { acc = combine(acc, compare(2)); } \
+    if ((count) > 3) { acc = combine(acc, compare(3)); } \
+    if ((count) > 4) { acc = combine(acc, compare(4)); } \
+    if ((count) > 5) { acc = combine(acc, compare(5)); } \
+    if ((count) > 6) { acc = combine(acc, compare(6)); } \
+    if ((count) > 7) { acc = combine(acc, compare(7)); }
+#define LEXGEN_C_OR(a, b) ((a) | (b))
+
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_first_bit(unsigned bits)
+{
+#if defined(_MSC_VER)
+    unsigned long idx; _BitScanForward(&idx, bits); return idx;
+#else
+    return (size_t)__builtin_ctz(bits);
+#endif
+}
+
+static LEXGEN_ALWAYS_INLINE int lexgen_c_is_stop(char c, const unsigned char* stops, int count)
+{
+    int k;
+    for (k = 0; k < count; k++)
+    {
+        if ((unsigned char)c == stops[k]) { return 1; }
+    }
+    return 0;
+}
+
+static LEXGEN_ALWAYS_INLINE int lexgen_c_in_set(char c, const unsigned char* rows)
+{
+    unsigned char b = (unsigned char)c;
+    return ((rows[(b & 0x0F) | ((b & 0x80) >> 3)] >> ((b >> 4) & 7)) & 1) != 0;
+}
+
+#if defined(LEXGEN_C_SIMD_AVX512BW)
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_first_bit64(unsigned long long bits)
+{
+#if defined(_MSC_VER)
+    unsigned long idx; _BitScanForward64(&idx, bits); return idx;
+#else
+    return (size_t)__builtin_ctzll(bits);
+#endif
+}
+
+/* 64 bytes per step; the last partial chunk is read with a masked load (masked-off lanes can't fault) instead of a scalar loop */
+static LEXGEN_ALWAYS_INLINE __mmask64 lexgen_c_tail_mask(size_t left) { return left >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << left) - 1; }
+
+#define LEXGEN_C_CMP_AVX512BW(k) _mm512_cmpeq_epi8_mask(chunk, _mm512_set1_epi8((char)stops[k]))
+
+LEXGEN_C_SIMD_TARGET("avx512bw")
+static LEXGEN_ALWAYS_INLINE __mmask64 lexgen_c_eq_mask_avx512bw(__m512i chunk, const unsigned char* stops, int count)
+{
+    __mmask64 hits;
+    LEXGEN_C_EQ_FOLD(hits, LEXGEN_C_OR, LEXGEN_C_CMP_AVX512BW, count)
+    return hits;
+}
+
+LEXGEN_C_SIMD_TARGET("avx512bw")
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_eq_avx512bw(const char* p, size_t n, const unsigned char* stops, int count)
+{
+    size_t i = 0;
+    __mmask64 valid, hits;
+    while (i + 64 <= n)
+    {
+        hits = lexgen_c_eq_mask_avx512bw(_mm512_loadu_si512(p + i), stops, count);
+        if (hits != 0) { return i + lexgen_c_first_bit64(hits); }
+        i += 64;
+    }
+    valid = lexgen_c_tail_mask(n - i);
+    hits = lexgen_c_eq_mask_avx512bw(_mm512_maskz_loadu_epi8(valid, p + i), stops, count) & valid;
+    return hits != 0 ? i + lexgen_c_first_bit64(hits) : n;
+}
+
+LEXGEN_C_SIMD_TARGET("avx512bw")
+static LEXGEN_ALWAYS_INLINE __mmask64 lexgen_c_set_mask_avx512bw(__m512i chunk, __m512i rows_lo, __m512i rows_hi, __m512i bit_lut)
+{
+    __m512i idx = _mm512_and_si512(chunk, _mm512_set1_epi8((char)0x8F));
+    __m512i row = _mm512_or_si512(_mm512_shuffle_epi8(rows_lo, idx), _mm512_shuffle_epi8(rows_hi, _mm512_xor_si512(idx, _mm512_set1_epi8((char)0x80))));
+    __m512i bit = _mm512_shuffle_epi8(bit_lut, _mm512_and_si512(_mm512_srli_epi16(chunk, 4), _mm512_set1_epi8(0x0F)));
+    return _mm512_test_epi8_mask(row, bit);
+}
+
+LEXGEN_C_SIMD_TARGET("avx512bw")
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_set_avx512bw(const char* p, size_t n, const unsigned char* rows, int count)
+{
+    const __m512i rows_lo = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_load_si128((const __m128i*)rows));
+    const __m512i rows_hi = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_load_si128((const __m128i*)(rows + 16)));
+    const __m512i bit_lut = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128));
+    size_t i = 0;
+    __mmask64 valid, hits;
+    (void)count;
+    while (i + 64 <= n)
+    {
+        hits = lexgen_c_set_mask_avx512bw(_mm512_loadu_si512(p + i), rows_lo, rows_hi, bit_lut);
+        if (hits != 0) { return i + lexgen_c_first_bit64(hits); }
+        i += 64;
+    }
+    valid = lexgen_c_tail_mask(n - i);
+    hits = lexgen_c_set_mask_avx512bw(_mm512_maskz_loadu_epi8(valid, p + i), rows_lo, rows_hi, bit_lut) & valid;
+    return hits != 0 ? i + lexgen_c_first_bit64(hits) : n;
+}
+#endif
+
+#if defined(LEXGEN_C_SIMD_AVX2)
+#define LEXGEN_C_CMP_AVX2(k) _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8((char)stops[k]))
+
+LEXGEN_C_SIMD_TARGET("avx2")
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_eq_avx2(const char* p, size_t n, const unsigned char* stops, int count)
+{
+    size_t i = 0;
+    while (i + 32 <= n)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i mask;
+        unsigned bits;
+        LEXGEN_C_EQ_FOLD(mask, _mm256_or_si256, LEXGEN_C_CMP_AVX2, count)
+        bits = (unsigned)_mm256_movemask_epi8(mask);
+        if (bits != 0) { return i + lexgen_c_first_bit(bits); }
+        i += 32;
+    }
+    while (i < n && !lexgen_c_is_stop(p[i], stops, count)) { i++; }
+    return i;
+}
+
+LEXGEN_C_SIMD_TARGET("avx2")
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_set_avx2(const char* p, size_t n, const unsigned char* rows, int count)
+{
+    const __m256i rows_lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)rows));
+    const __m256i rows_hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)(rows + 16)));
+    const __m256i bit_lut = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    size_t i = 0;
+    (void)count;
+    while (i + 32 <= n)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i idx = _mm256_and_si256(chunk, _mm256_set1_epi8((char)0x8F));
+        __m256i row = _mm256_or_si256(_mm256_shuffle_epi8(rows_lo, idx), _mm256_shuffle_epi8(rows_hi, _mm256_xor_si256(idx, _mm256_set1_epi8((char)0x80))));
+        __m256i bit = _mm256_shuffle_epi8(bit_lut, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), _mm256_set1_epi8(0x0F)));
+        unsigned bits = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit));
+        if (bits != 0) { return i + lexgen_c_first_bit(bits); }
+        i += 32;
+    }
+    while (i < n && !lexgen_c_in_set(p[i], rows)) { i++; }
+    return i;
+}
+#endif
+
+/* baseline: whatever the -m flags guarantee */
+/* portable: eight bytes per uint64_t step with exact per-byte tests (carries never cross a byte lane) */
+#define LEXGEN_C_SWAR_ONES 0x0101010101010101ULL
+#define LEXGEN_C_SWAR_HIGHS 0x8080808080808080ULL
+#define LEXGEN_C_SWAR_LOWS 0x7F7F7F7F7F7F7F7FULL
+
+static LEXGEN_ALWAYS_INLINE unsigned long long lexgen_c_swar_load(const char* p, size_t len)
+{
+    unsigned long long w = 0;
+    memcpy(&w, p, len);
+    return w;
+}
+
+/* high bit of every lane holding one of the first `len` bytes of a load */
+static LEXGEN_ALWAYS_INLINE unsigned long long lexgen_c_swar_valid(size_t len)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return len >= 8 ? LEXGEN_C_SWAR_HIGHS : LEXGEN_C_SWAR_HIGHS & ~(~0ULL >> (8 * len));
+#else
+    return len >= 8 ? LEXGEN_C_SWAR_HIGHS : LEXGEN_C_SWAR_HIGHS & ((1ULL << (8 * len)) - 1);
+#endif
+}
+
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_swar_first(unsigned long long lanes)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (size_t)__builtin_clzll(lanes) / 8;
+#elif defined(_MSC_VER)
+    unsigned long idx; _BitScanForward64(&idx, lanes); return idx / 8;
+#else
+    return (size_t)__builtin_ctzll(lanes) / 8;
+#endif
+}
+
+/* lanes >= c, for 0 <= c <= 256: the low seven bits are compared with the lane's top bit forced on, so the subtraction can't borrow */
+static LEXGEN_ALWAYS_INLINE unsigned long long lexgen_c_swar_ge(unsigned long long w, unsigned c)
+{
+    unsigned long long low = (w & LEXGEN_C_SWAR_LOWS) | LEXGEN_C_SWAR_HIGHS;
+    if (c == 0) { return LEXGEN_C_SWAR_HIGHS; }
+    if (c >= 256) { return 0; }
+    if (c < 128) { return (w | (low - LEXGEN_C_SWAR_ONES * c)) & LEXGEN_C_SWAR_HIGHS; }
+    return w & (low - LEXGEN_C_SWAR_ONES * (c - 128)) & LEXGEN_C_SWAR_HIGHS;
+}
+
+static LEXGEN_ALWAYS_INLINE unsigned long long lexgen_c_swar_eq_lanes(unsigned long long w, const unsigned char* stops, int count)
+{
+    unsigned long long hits = 0;
+    int k;
+    for (k = 0; k < count; k++)
+    {
+        unsigned long long x = w ^ (LEXGEN_C_SWAR_ONES * stops[k]);
+        hits |= ~(((x & LEXGEN_C_SWAR_LOWS) + LEXGEN_C_SWAR_LOWS) | x) & LEXGEN_C_SWAR_HIGHS;
+    }
+    return hits;
+}
+
+static LEXGEN_ALWAYS_INLINE unsigned long long lexgen_c_swar_set_lanes(unsigned long long w, const unsigned char* ranges, int count)
+{
+    unsigned long long safe = 0;
+    int k;
+    for (k = 0; k < count; k++)
+    {
+        safe |= lexgen_c_swar_ge(w, ranges[2 * k]) & ~lexgen_c_swar_ge(w, ranges[2 * k + 1] + 1U);
+    }
+    return ~safe & LEXGEN_C_SWAR_HIGHS;
+}
+
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_eq_swar(const char* p, size_t n, const unsigned char* stops, int count)
+{
+    size_t i = 0;
+    unsigned long long hits;
+    while (i + 8 <= n)
+    {
+        hits = lexgen_c_swar_eq_lanes(lexgen_c_swar_load(p + i, 8), stops, count);
+        if (hits != 0) { return i + lexgen_c_swar_first(hits); }
+        i += 8;
+    }
+    if (i == n) { return n; }
+    hits = lexgen_c_swar_eq_lanes(lexgen_c_swar_load(p + i, n - i), stops, count) & lexgen_c_swar_valid(n - i);
+    return hits != 0 ? i + lexgen_c_swar_first(hits) : n;
+}
+
+/* sets with too many ranges come with none, and are left to the DFA */
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_set_swar(const char* p, size_t n, const unsigned char* rows, int count)
+{
+    const unsigned char* ranges = rows + 32;
+    size_t i = 0;
+    unsigned long long hits;
+    if (count == 0) { return 0; }
+    while (i + 8 <= n)
+    {
+        hits = lexgen_c_swar_set_lanes(lexgen_c_swar_load(p + i, 8), ranges, count);
+        if (hits != 0) { return i + lexgen_c_swar_first(hits); }
+        i += 8;
+    }
+    if (i == n) { return n; }
+    hits = lexgen_c_swar_set_lanes(lexgen_c_swar_load(p + i, n - i), ranges, count) & lexgen_c_swar_valid(n - i);
+    return hits != 0 ? i + lexgen_c_swar_first(hits) : n;
+}
+
+#if defined(LEXGEN_C_SIMD_HAS_SSE42)
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_eq_baseline(const char* p, size_t n, const unsigned char* stops, int count)
+{
+    __m128i needle = _mm_loadu_si128((const __m128i*)stops);
+    size_t i = 0;
+    while (i + 16 <= n)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
+        int idx = _mm_cmpestri(needle, count, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16) { return i + (size_t)idx; }
+        i += 16;
+    }
+    while (i < n && !lexgen_c_is_stop(p[i], stops, count)) { i++; }
+    return i;
+}
+#elif defined(LEXGEN_C_SIMD_HAS_SSE2)
+#define LEXGEN_C_CMP_SSE2(k) _mm_cmpeq_epi8(chunk, _mm_set1_epi8((char)stops[k]))
+
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_eq_baseline(const char* p, size_t n, const unsigned char* stops, int count)
+{
+    size_t i = 0;
+    while (i + 16 <= n)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i mask;
+        unsigned bits;
+        LEXGEN_C_EQ_FOLD(mask, _mm_or_si128, LEXGEN_C_CMP_SSE2, count)
+        bits = (unsigned)_mm_movemask_epi8(mask);
+        if (bits != 0) { return i + lexgen_c_first_bit(bits); }
+        i += 16;
+    }
+    while (i < n && !lexgen_c_is_stop(p[i], stops, count)) { i++; }
+    return i;
+}
+#elif defined(LEXGEN_C_SIMD_HAS_VECTOR_EXT)
+/* no x86 SIMD: GCC/Clang generic vectors, which lower to the target's own 16-byte vectors (NEON, RVV, ...) */
+typedef unsigned char lexgen_c_v16 __attribute__((vector_size(16)));
+
+static LEXGEN_ALWAYS_INLINE lexgen_c_v16 lexgen_c_load_v16(const char* p)
+{
+    lexgen_c_v16 v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+/* index of the first nonzero lane, or 16 */
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_first_lane(lexgen_c_v16 hits)
+{
+    unsigned long long lo, hi;
+    memcpy(&lo, &hits, 8);
+    memcpy(&hi, (const unsigned char*)&hits + 8, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    if (lo != 0) { return (size_t)__builtin_clzll(lo) / 8; }
+    if (hi != 0) { return 8 + (size_t)__builtin_clzll(hi) / 8; }
+#else
+    if (lo != 0) { return (size_t)__builtin_ctzll(lo) / 8; }
+    if (hi != 0) { return 8 + (size_t)__builtin_ctzll(hi) / 8; }
+#endif
+    return 16;
+}
+
+#define LEXGEN_C_CMP_VEC(k) (lexgen_c_v16)(chunk == stops[k])
+
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_eq_baseline(const char* p, size_t n, const unsigned char* stops, int count)
+{
+    size_t i = 0;
+    while (i + 16 <= n)
+    {
+        lexgen_c_v16 chunk = lexgen_c_load_v16(p + i);
+        lexgen_c_v16 mask;
+        size_t lane;
+        LEXGEN_C_EQ_FOLD(mask, LEXGEN_C_OR, LEXGEN_C_CMP_VEC, count)
+        lane = lexgen_c_first_lane(mask);
+        if (lane < 16) { return i + lane; }
+        i += 16;
+    }
+    while (i < n && !lexgen_c_is_stop(p[i], stops, count)) { i++; }
+    return i;
+}
+#else
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_eq_baseline(const char* p, size_t n, const unsigned char* stops, int count)
+{
+    return lexgen_c_scan_eq_swar(p, n, stops, count);
+}
+#endif
+
+#if defined(LEXGEN_C_SIMD_HAS_SSSE3)
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_set_baseline(const char* p, size_t n, const unsigned char* rows, int count)
+{
+    const __m128i rows_lo = _mm_load_si128((const __m128i*)rows);
+    const __m128i rows_hi = _mm_load_si128((const __m128i*)(rows + 16));
+    const __m128i bit_lut = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    size_t i = 0;
+    (void)count;
+    while (i + 16 <= n)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i idx = _mm_and_si128(chunk, _mm_set1_epi8((char)0x8F));
+        __m128i row = _mm_or_si128(_mm_shuffle_epi8(rows_lo, idx), _mm_shuffle_epi8(rows_hi, _mm_xor_si128(idx, _mm_set1_epi8((char)0x80))));
+        __m128i bit = _mm_shuffle_epi8(bit_lut, _mm_and_si128(_mm_srli_epi16(chunk, 4), _mm_set1_epi8(0x0F)));
+        unsigned bits = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), bit));
+        if (bits != 0) { return i + lexgen_c_first_bit(bits); }
+        i += 16;
+    }
+    while (i < n && !lexgen_c_in_set(p[i], rows)) { i++; }
+    return i;
+}
+#elif defined(LEXGEN_C_SIMD_HAS_VECTOR_EXT) && !defined(__clang__) && !defined(__x86_64__) && !defined(__i386__)
+/* GCC's __builtin_shuffle takes a runtime index vector (TBL on AArch64, vrgather on RVV); it wraps indices mod 16, so the upper
+ * row table is blended in by the byte's top bit */
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_set_baseline(const char* p, size_t n, const unsigned char* rows, int count)
+{
+    const lexgen_c_v16 rows_lo = lexgen_c_load_v16((const char*)rows);
+    const lexgen_c_v16 rows_hi = lexgen_c_load_v16((const char*)(rows + 16));
+    const lexgen_c_v16 bit_lut = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    size_t i = 0;
+    (void)count;
+    while (i + 16 <= n)
+    {
+        lexgen_c_v16 chunk = lexgen_c_load_v16(p + i);
+        lexgen_c_v16 idx = chunk & 0x0F;
+        lexgen_c_v16 upper = (lexgen_c_v16)(chunk >= 0x80);
+        lexgen_c_v16 row = (__builtin_shuffle(rows_lo, idx) & ~upper) | (__builtin_shuffle(rows_hi, idx) & upper);
+        lexgen_c_v16 bit = __builtin_shuffle(bit_lut, (lexgen_c_v16)((chunk >> 4) & 7));
+        size_t lane = lexgen_c_first_lane((lexgen_c_v16)((row & bit) != 0));
+        if (lane < 16) { return i + lane; }
+        i += 16;
+    }
+    while (i < n && !lexgen_c_in_set(p[i], rows)) { i++; }
+    return i;
+}
+#else
+static LEXGEN_ALWAYS_INLINE size_t lexgen_c_scan_set_baseline(const char* p, size_t n, const unsigned char* rows, int count)
+{
+    return lexgen_c_scan_set_swar(p, n, rows, count);
+}
+#endif
 
-            out << std::format("    switch ({})\n    {{\n", class_expr);
-            for (const auto& [target, class_ids] : groups)
-            {
-                for (auto class_id : class_ids)
-                {
-                    out << std::format("    case {}: ", class_id);
-                    total_cases++;
-                }
-                out << std::format("goto STATE_{};\n", target);
-            }
-            out << "    default: goto FAIL;\n    }\n\n";
-        }
+#if defined(LEXGEN_C_SIMD_DISPATCH)
+/* 0 (baseline) until the constructor has run, which is always safe */
+static int lexgen_c_isa_level;
 
-        out << "FAIL:\n";
-        out << "    if (latest_match == -1)\n    {\n";
-        out << "        " << handle_error << "\n";
-        out << "    }\n\n";
-        out << "    src.backtrack();\n";
-        out << "    {\n";
-        out << "        [[maybe_unused]] std::string_view buffer = src.text();\n";
-        out << "        switch (latest_match)\n        {\n";
+__attribute__((constructor)) static void lexgen_c_detect_isa(void)
+{
+    __builtin_cpu_init();
+    lexgen_c_isa_level = __builtin_cpu_supports("avx512bw") ? 2 : __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+#endif
 
-        for (const auto& [nfa_state, handler] : dfa.handler_map)
-        {
-            out << std::format("        case {}: {}\n", nfa_state, handler);
-        }
+#if defined(LEXGEN_C_SIMD_AVX512BW)
+#define LEXGEN_C_SCAN_TIER_AVX512BW(name, kind, data, count) \
+    LEXGEN_C_SIMD_TARGET("avx512bw") static size_t name##_avx512bw(const char* p, size_t n) { return lexgen_c_scan_##kind##_avx512bw(p, n, data, count); }
+#else
+#define LEXGEN_C_SCAN_TIER_AVX512BW(name, kind, data, count)
+#endif
+#if defined(LEXGEN_C_SIMD_AVX2)
+#define LEXGEN_C_SCAN_TIER_AVX2(name, kind, data, count) \
+    LEXGEN_C_SIMD_TARGET("avx2") static size_t name##_avx2(const char* p, size_t n) { return lexgen_c_scan_##kind##_avx2(p, n, data, count); }
+#else
+#define LEXGEN_C_SCAN_TIER_AVX2(name, kind, data, count)
+#endif
 
-        out << "        default:\n            " << handle_internal_error << "\n";
-        out << "        }\n    }\n\n";
+#if defined(LEXGEN_C_SIMD_HAS_AVX512BW)
+#define LEXGEN_C_SCAN_PICK(name, kind, data, count) name##_avx512bw(p, n)
+#elif defined(LEXGEN_C_SIMD_DISPATCH)
+#define LEXGEN_C_SCAN_PICK(name, kind, data, count) \
+    (lexgen_c_isa_level == 2 ? name##_avx512bw(p, n) : lexgen_c_isa_level == 1 ? name##_avx2(p, n) : lexgen_c_scan_##kind##_baseline(p, n, data, count))
+#elif defined(LEXGEN_C_SIMD_HAS_AVX2)
+#define LEXGEN_C_SCAN_PICK(name, kind, data, count) name##_avx2(p, n)
+#else
+#define LEXGEN_C_SCAN_PICK(name, kind, data, count) lexgen_c_scan_##kind##_baseline(p, n, data, count)
+#endif
 
-        out << "    latest_match = -1;\n";
-        out << "    src.start_token();\n";
-        out << "    start_bytes = src.bytes();\n";
-        out << std::format("    goto STATE_{};\n", dfa.start_state);
-        out << "}\n";
+/* defines `size_t name(const char* p, size_t n)`: the length of the run before the first stop byte */
+#define LEXGEN_C_SCAN_FN(name, kind, data, count) \
+    LEXGEN_C_SCAN_TIER_AVX512BW(name, kind, data, count) \
+    LEXGEN_C_SCAN_TIER_AVX2(name, kind, data, count) \
+    static size_t name(const char* p, size_t n) { return LEXGEN_C_SCAN_PICK(name, kind, data, count); }
+#endif
 
-        return {.state_count = dfa.state_count, .case_count = total_cases};
+)c";
     }
 
     void emit_simd_scan_fn_c(std::ostream& out, const std::string& name, const std::vector<char>& stops)
     {
-        std::string mask_lines;
-        for (auto stop : stops)
+        std::string bytes;
+        if (stops.size() > SIMD_MAX_STOP_BYTES)
         {
-            mask_lines += std::format(
-                "        mask = _mm_or_si128(mask, _mm_cmpeq_epi8(chunk, _mm_set1_epi8((char){})));\n", static_cast<int>(static_cast<unsigned char>(stop))
-            );
+            for (auto row : nibble_rows(stops))
+            {
+                bytes += std::format("{}{}", bytes.empty() ? "" : ",", row);
+            }
+            auto ranges = safe_ranges(stops);
+            for (auto [lo, hi] : ranges)
+            {
+                bytes += std::format(",{},{}", lo, hi);
+            }
+            out << std::format("LEXGEN_C_ALIGN16 static const unsigned char {0}_rows[{1}] = {{{2}}};\n", name, 32 + 2 * ranges.size(), bytes);
+            out << std::format("LEXGEN_C_SCAN_FN({0}, set, {0}_rows, {1})\n\n", name, ranges.size());
+            return;
         }
 
-        std::string cmp_chain;
-        for (std::size_t i = 0; i < stops.size(); i++)
+        for (auto stop : stops)
         {
-            cmp_chain += std::format("{}c == (char){}", i == 0 ? "" : " || ", static_cast<int>(static_cast<unsigned char>(stops[i])));
+            bytes += std::format("{}{}", bytes.empty() ? "" : ",", static_cast<int>(static_cast<unsigned char>(stop)));
         }
-
-        out << std::format(
-            R"c(#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
-#include <emmintrin.h>
-static size_t {0}(const char* p, size_t n)
-{{
-    size_t i = 0;
-    while (i + 16 <= n)
-    {{
-        __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
-        __m128i mask = _mm_setzero_si128();
-{1}        {{
-        unsigned bits = (unsigned)_mm_movemask_epi8(mask);
-        if (bits != 0)
-        {{
-#if defined(_MSC_VER)
-            unsigned long idx; _BitScanForward(&idx, bits); return i + idx;
-#else
-            return i + (size_t)__builtin_ctz(bits);
-#endif
-        }}
-        }}
-        i += 16;
-    }}
-    while (i < n)
-    {{
-        char c = p[i];
-        if ({2}) {{ return i; }}
-        i++;
-    }}
-    return i;
-}}
-#else
-static size_t {0}(const char* p, size_t n)
-{{
-    size_t i = 0;
-    while (i < n)
-    {{
-        char c = p[i];
-        if ({2}) {{ return i; }}
-        i++;
-    }}
-    return i;
-}}
-#endif
-
-)c",
-            name, mask_lines, cmp_chain
-        );
+        out << std::format("static const unsigned char {0}_stops[16] = {{{1}}};\n", name, bytes);
+        out << std::format("LEXGEN_C_SCAN_FN({0}, eq, {0}_stops, {1})\n\n", name, stops.size());
     }
 
     auto emit_c(
         std::ostream& out, const dfa_view& dfa, const std::string& inc, const std::string& handle_error, const std::string& handle_internal_error,
-        bool enable_simd
+        const lexergen::codegen_options& options
     ) -> lexergen::codegen_result
     {
+        const bool enable_simd = options.enable_simd;
         if (dfa.emit_prelude)
         {
             out << "#include <stdint.h>\n#include <stddef.h>\n\n";
             out << "typedef struct { const char *ptr; size_t len; } lex_text;\n\n";
             out << inc << "\n\n";
-            out << "#ifndef LEX_RESULT_TYPE\n#define LEX_RESULT_TYPE int\n#endif\n\n";
+            emit_token_types(out, lexergen::target_lang::C, options.token_kinds);
+            out << std::format("#ifndef LEX_RESULT_TYPE\n#define LEX_RESULT_TYPE {}\n#endif\n\n", options.token_kinds.empty() ? "int" : "lex_token");
             out << "#if defined(__GNUC__) || defined(__clang__)\n#define LEXGEN_ALWAYS_INLINE __attribute__((always_inline)) inline\n#else\n#define "
                    "LEXGEN_ALWAYS_INLINE inline\n#endif\n\n";
         }
 
+        if (dfa.emit_prelude && enable_simd)
+        {
+            emit_c_simd_prelude(out);
+        }
+
         auto simd_states = enable_simd ? find_simd_states(dfa) : std::unordered_map<int64_t, std::vector<char>>{};
         std::unordered_map<int64_t, std::string> simd_fn_names;
         if (enable_simd && !simd_states.empty())
@@ -685,10 +3383,34 @@ static size_t {0}(const char* p, size_t n)
         }
 
         auto class_expr = emit_c_family_classifier(out, dfa, "Source_peek(src)", false);
+        // trailing context needs the raw cursor, as in emit_cpp
+        const bool trailing = !dfa.trailing_rules.empty();
+        const bool raw = options.sentinel || trailing || !options.batch_fn_name.empty();
+        auto raw_class_expr = raw ? emit_raw_classifier(out, dfa, false) : std::string();
+
+        std::unordered_map<int64_t, std::string> raw_simd_calls;
+        for (const auto& [state, name] : simd_fn_names)
+        {
+            raw_simd_calls[state] = std::format("{}(p, (size_t)(raw_end - p))", name);
+        }
+
+        if (!options.batch_fn_name.empty())
+        {
+            emit_raw_batch(out, dfa, options.batch_fn_name, raw_class_expr, raw_simd_calls, false, options.sentinel);
+        }
 
         out << std::format("LEXGEN_ALWAYS_INLINE LEX_RESULT_TYPE {}(Source *src, Ctx *ctx)\n{{\n", dfa.fn_name);
         out << "    (void)ctx;\n";
         out << "    int64_t latest_match = -1;\n";
+
+        if (options.sentinel || trailing)
+        {
+            out << "\n";
+            auto total_cases =
+                emit_raw_body(out, dfa, raw_class_expr, raw_simd_calls, handle_error, handle_internal_error, false, options.sentinel);
+            out << "}\n";
+            return {.state_count = dfa.state_count, .case_count = total_cases};
+        }
         out << "\n    Source_start_token(src);\n";
         out << "    size_t start_bytes = Source_bytes(src);\n";
         out << "    (void)start_bytes;\n\n";
@@ -702,7 +3424,7 @@ static size_t {0}(const char* p, size_t n)
 
             if (auto simd_it = simd_fn_names.find(state); simd_it != simd_fn_names.end())
             {
-                out << "#ifdef LEXGEN_C_SOURCE_HAS_SCAN\n    {\n";
+                out << "#if (defined(Source_remaining) && defined(Source_skip)) || defined(LEXGEN_C_SOURCE_HAS_SCAN)\n    {\n";
                 out << "        lex_text simd_span = Source_remaining(src);\n";
                 out << std::format("        size_t simd_n = {}(simd_span.ptr, simd_span.len);\n", simd_it->second);
                 out << "        if (simd_n > 0) { Source_skip(src, simd_n); }\n    }\n#endif\n";
@@ -713,24 +3435,7 @@ static size_t {0}(const char* p, size_t n)
                 out << std::format("    latest_match = {};\n    Source_accept(src);\n", dfa.end_to_nfa_state[state]);
             }
 
-            auto groups = build_class_groups(dfa, state);
-            if (groups.empty())
-            {
-                out << "    goto FAIL;\n\n";
-                continue;
-            }
-
-            out << std::format("    switch ({})\n    {{\n", class_expr);
-            for (const auto& [target, class_ids] : groups)
-            {
-                for (auto class_id : class_ids)
-                {
-                    out << std::format("    case {}: ", class_id);
-                    total_cases++;
-                }
-                out << std::format("goto STATE_{};\n", target);
-            }
-            out << "    default: goto FAIL;\n    }\n\n";
+            total_cases += emit_goto_switch(out, dfa, state, class_expr, "");
         }
 
         out << "FAIL:\n";
@@ -762,8 +3467,6 @@ static size_t {0}(const char* p, size_t n)
 
     auto emit_js_family_classifier(std::ostream& out, const dfa_view& dfa, bool is_java) -> std::string
     {
-        const auto class_count = dfa.classes.class_count();
-        const auto sentinel = static_cast<int64_t>(class_count);
         const char* int_arr = is_java ? "int[]" : "";
         const char* decl = is_java ? "static final " : "const ";
 
@@ -782,23 +3485,44 @@ static size_t {0}(const char* p, size_t n)
             return std::format("{}BYTE_CLASS[src.peek()]", prefix);
         }
 
-        const auto& boundaries = dfa.classes.get_boundaries();
-        out << decl << (is_java ? "int[]" : "") << std::format(" {}CLASS_BOUNDARIES = ", prefix) << (is_java ? "new int[] " : "") << open;
-        for (auto bound : boundaries)
+        auto trie = build_codepoint_trie(dfa.classes);
+        const auto unpack_fn = prefix + "unpackTable";
+        if (is_java)
         {
-            out << bound << ",";
+            out << std::format("static int[] {}(String... parts)\n{{\n", unpack_fn);
+            out << "    StringBuilder sb = new StringBuilder();\n";
+            out << "    for (String part : parts) sb.append(part);\n";
+            out << "    int[] table = new int[sb.length() / 2];\n";
+            out << "    for (int i = 0; i < table.length; i++) table[i] = (sb.charAt(2 * i) << 16) | sb.charAt(2 * i + 1);\n";
+            out << "    return table;\n";
+            out << "}\n\n";
+        }
+        for (const auto& [name, table] : {std::pair{"STAGE1", &trie.stage1}, std::pair{"STAGE2", &trie.stage2}, std::pair{"STAGE3", &trie.stage3}})
+        {
+            if (is_java)
+            {
+                out << std::format("static final int[] {}CP_{} = {};\n", prefix, name, java_table_literal(*table, unpack_fn));
+                continue;
+            }
+            out << std::format("const {}CP_{} = new {}([", prefix, name, js_table_type(*table));
+            for (auto value : *table)
+            {
+                out << value << ",";
+            }
+            out << "]);\n";
         }
-        out << close << ";\n\n";
+        out << "\n";
+
+        const auto lookup = std::format(
+            "{0}CP_STAGE3[{0}CP_STAGE2[{0}CP_STAGE1[cp >> {1}] + ((cp >> {2}) & 0x{3:X})] + (cp & 0x{4:X})]", prefix, CP_STAGE1_SHIFT, CP_STAGE3_SHIFT,
+            (1U << (CP_STAGE1_SHIFT - CP_STAGE3_SHIFT)) - 1, (1U << CP_STAGE3_SHIFT) - 1
+        );
 
         if (is_java)
         {
             out << std::format("static int {}classifyCp(int cp)\n{{\n", prefix);
-            out << std::format("    int lo = 0, hi = {}CLASS_BOUNDARIES.length;\n", prefix);
-            out << std::format(
-                "    while (lo + 1 < hi) {{ int mid = lo + (hi - lo) / 2; if ({}CLASS_BOUNDARIES[mid] <= cp) lo = mid; else hi = mid; }}\n", prefix
-            );
-            out << std::format("    if (lo + 1 >= {}CLASS_BOUNDARIES.length) return {};\n", prefix, sentinel);
-            out << "    return lo;\n";
+            out << std::format("    if (cp < 0x{:X}) return {}CP_STAGE3[cp];\n", CP_ASCII_END, prefix);
+            out << std::format("    return {};\n", lookup);
             out << "}\n\n";
             out << std::format("static int {}decodeUtf8Cp(Source src)\n{{\n", prefix);
             out << "    int b0 = src.peek();\n";
@@ -816,14 +3540,8 @@ static size_t {0}(const char* p, size_t n)
         }
 
         out << std::format("function {}classifyCp(cp)\n{{\n", prefix);
-        out << std::format("    let lo = 0, hi = {}CLASS_BOUNDARIES.length;\n", prefix);
-        out << std::format(
-            "    while (lo + 1 < hi) {{ const mid = lo + Math.floor((hi - lo) / 2); if ({}CLASS_BOUNDARIES[mid] <= cp) lo = mid; else hi = mid; "
-            "}}\n",
-            prefix
-        );
-        out << std::format("    if (lo + 1 >= {}CLASS_BOUNDARIES.length) return {};\n", prefix, sentinel);
-        out << "    return lo;\n";
+        out << std::format("    if (cp < 0x{:X}) return {}CP_STAGE3[cp];\n", CP_ASCII_END, prefix);
+        out << std::format("    return {};\n", lookup);
         out << "}\n\n";
         out << std::format("function {}decodeUtf8Cp(src)\n{{\n", prefix);
         out << "    const b0 = src.peek();\n";
@@ -842,12 +3560,13 @@ static size_t {0}(const char* p, size_t n)
 
     auto emit_switch_loop(
         std::ostream& out, const dfa_view& dfa, const std::string& inc, const std::string& handle_error, const std::string& handle_internal_error,
-        bool is_java
+        const lexergen::codegen_options& options, bool is_java
     ) -> lexergen::codegen_result
     {
         if (dfa.emit_prelude)
         {
             out << inc << "\n\n";
+            emit_token_types(out, is_java ? lexergen::target_lang::JAVA : lexergen::target_lang::JS, options.token_kinds);
         }
         auto class_expr = emit_js_family_classifier(out, dfa, is_java);
 
@@ -901,105 +3620,385 @@ static size_t {0}(const char* p, size_t n)
             out << "        default: state = -1; continue;\n        }\n    }\n";
         }
 
-        out << "    case -1: {\n";
-        out << "        if (latestMatch == -1) {\n";
-        out << "            " << handle_error << "\n";
-        out << "        }\n\n";
-        out << "        src.backtrack();\n";
-        out << (is_java ? "        String buffer = src.text();\n" : "        const buffer = src.text();\n");
-        out << "        switch (latestMatch) {\n";
+        out << "    case -1: {\n";
+        out << "        if (latestMatch == -1) {\n";
+        out << "            " << handle_error << "\n";
+        out << "        }\n\n";
+        out << "        src.backtrack();\n";
+        out << (is_java ? "        String buffer = src.text();\n" : "        const buffer = src.text();\n");
+        out << "        switch (latestMatch) {\n";
+
+        for (const auto& [nfa_state, handler] : dfa.handler_map)
+        {
+            out << std::format("        case {}: {}\n", nfa_state, handler);
+        }
+
+        out << "        default:\n            " << handle_internal_error << "\n";
+        out << "        }\n\n";
+
+        out << "        latestMatch = -1;\n";
+        out << "        src.startToken();\n";
+        out << "        startBytes = src.bytes();\n";
+        out << std::format("        state = {};\n", dfa.start_state);
+        out << "        continue;\n    }\n";
+        out << "    }\n    }\n}\n";
+
+        return {.state_count = dfa.state_count, .case_count = total_cases};
+    }
+
+    auto describe_cp_plain(uint32_t cp) -> std::string
+    {
+        switch (cp)
+        {
+        case '\n':
+            return "\\n";
+        case '\r':
+            return "\\r";
+        case '\t':
+            return "\\t";
+        case '\0':
+            return "\\0";
+        case '\\':
+            return "\\\\";
+        default:
+            break;
+        }
+
+        if (cp >= 0x20 && cp < 0x7F)
+        {
+            return std::string(1, static_cast<char>(cp));
+        }
+        if (cp <= 0xFF)
+        {
+            return std::format("\\x{:02x}", cp);
+        }
+        return std::format("U+{:04X}", cp);
+    }
+
+    auto describe_interval_plain(lexergen::interval_set::codepoint lo, lexergen::interval_set::codepoint hi) -> std::string
+    {
+        if (lo == hi)
+        {
+            return describe_cp_plain(lo);
+        }
+        return std::format("{}-{}", describe_cp_plain(lo), describe_cp_plain(hi));
+    }
+
+    // one character of [lo, hi] to spell an example input with: a letter or at least something printable where there is one
+    auto example_cp(lexergen::interval_set::codepoint lo, lexergen::interval_set::codepoint hi) -> uint32_t
+    {
+        if (lo <= 'a' && 'a' <= hi)
+        {
+            return 'a';
+        }
+        if (lo <= 0x7E && hi >= 0x21)
+        {
+            return std::max<uint32_t>(lo, 0x21);
+        }
+        return lo;
+    }
+
+} // namespace
+
+auto lexergen::dfa::codegen(
+    std::ostream& out, const std::string& inc, const std::string& handle_error, const std::string& handle_internal_error,
+    const codegen_options& options
+) const -> codegen_result
+{
+    // TOKEN rules get their return generated here, so every emitter dispatches to them like to any other handler
+    auto handlers = handler_map;
+    for (const auto& [nfa_state, kind] : token_rules)
+    {
+        handlers[nfa_state] = token_return(options.lang, options.token_kinds[static_cast<std::size_t>(kind)]);
+    }
+
+    const auto memo_states = options.linear ? linear_memo_states() : std::vector<int64_t>{};
+    const dfa_view view{
+        .start_state = start_state,
+        .state_count = static_cast<std::size_t>(get_state_count()),
+        .transition_table = transition_table,
+        .end_bitmask = end_bitmask,
+        .end_to_nfa_state = end_to_nfa_state,
+        .handler_map = handlers,
+        .rule_ids = rule_ids,
+        .batch_handlers = batch_handlers,
+        .token_rules = token_rules,
+        .trailing_rules = trailing_rules,
+        .trail_marks = trail_marks,
+        .memo_states = memo_states,
+        .classes = classes,
+        .fn_name = options.fn_name.empty() ? base_fn_name(options.lang) : options.fn_name,
+        .emit_prelude = options.emit_prelude,
+    };
+
+    switch (options.lang)
+    {
+    case target_lang::CPP:
+        return emit_cpp(out, view, inc, handle_error, handle_internal_error, options);
+    case target_lang::C:
+        return emit_c(out, view, inc, handle_error, handle_internal_error, options);
+    case target_lang::JAVA:
+        return emit_switch_loop(out, view, inc, handle_error, handle_internal_error, options, true);
+    case target_lang::JS:
+        return emit_switch_loop(out, view, inc, handle_error, handle_internal_error, options, false);
+    }
+
+    return {.state_count = 0, .case_count = 0};
+}
+
+auto lexergen::dfa::codegen_states(
+    std::ostream& out, const std::string& inc, std::span<const state_machine> states, const codegen_options& options
+) -> codegen_result
+{
+    // Byte-level DFAs can share one class table: the classes of the merged table are the intersections of every DFA's classes, and
+    // each DFA's transitions are re-indexed by them. A codepoint-level DFA keeps its own trie.
+    const bool merge_classes = std::ranges::none_of(states, [](const auto& state) { return state.machine->classes.max_codepoint() > 0xFF; });
+    std::vector<interval_set> class_sets;
+    if (merge_classes)
+    {
+        for (const auto& state : states)
+        {
+            const auto& classes = state.machine->classes;
+            for (std::size_t c = 0; c < classes.class_count(); c++)
+            {
+                auto iv = classes.class_interval(static_cast<int64_t>(c));
+                class_sets.push_back(interval_set::range(iv.lo, iv.hi));
+            }
+        }
+    }
+    const auto merged_classes = equivalence_classes::build(class_sets);
+
+    // the views below point into these, so they must not reallocate
+    std::vector<std::vector<int64_t>> transitions;
+    std::vector<std::vector<int64_t>> end_states;
+    std::vector<std::unordered_map<int64_t, std::string>> handlers;
+    std::vector<std::unordered_map<int64_t, trailing_cut>> trailing;
+    std::vector<std::vector<std::vector<int64_t>>> marks;
+    std::vector<std::string> fn_names;
+    transitions.reserve(states.size());
+    end_states.reserve(states.size());
+    handlers.reserve(states.size());
+    trailing.reserve(states.size());
+    marks.reserve(states.size());
+    fn_names.reserve(states.size());
+
+    const auto base_name = options.fn_name.empty() ? base_fn_name(options.lang) : options.fn_name;
+    const std::vector<int64_t> no_memo;
+    std::vector<state_view> views;
+    int64_t match_offset = 0;
+    for (std::size_t i = 0; i < states.size(); i++)
+    {
+        const auto& machine = *states[i].machine;
+
+        auto& transition_table = transitions.emplace_back();
+        if (merge_classes)
+        {
+            const auto old_width = machine.classes.class_count() + 1;
+            const auto new_width = merged_classes.class_count() + 1;
+            std::vector<std::size_t> old_class(new_width, machine.classes.class_count());
+            for (std::size_t c = 0; c < merged_classes.class_count(); c++)
+            {
+                old_class[c] = static_cast<std::size_t>(machine.classes.classify(merged_classes.class_interval(static_cast<int64_t>(c)).lo));
+            }
+
+            transition_table.resize(static_cast<std::size_t>(machine.get_state_count()) * new_width);
+            for (std::size_t s = 0; s < static_cast<std::size_t>(machine.get_state_count()); s++)
+            {
+                for (std::size_t c = 0; c < new_width; c++)
+                {
+                    transition_table[(s * new_width) + c] = machine.transition_table[(s * old_width) + old_class[c]];
+                }
+            }
+        }
+        else
+        {
+            transition_table = machine.transition_table;
+        }
+
+        // accepting NFA states are numbered per DFA; shift them apart so one handler switch can serve every STATE
+        auto& end_to_nfa_state = end_states.emplace_back(machine.end_to_nfa_state);
+        int64_t max_match = -1;
+        for (auto& nfa_state : end_to_nfa_state)
+        {
+            max_match = std::max(max_match, nfa_state);
+            nfa_state = nfa_state == -1 ? -1 : nfa_state + match_offset;
+        }
+
+        auto& state_handlers = handlers.emplace_back();
+        for (const auto& [nfa_state, handler] : machine.handler_map)
+        {
+            // a rule that never wins still has a handler, which mustn't collide with the next STATE's
+            max_match = std::max(max_match, nfa_state);
+            state_handlers[nfa_state + match_offset] = handler;
+        }
+        for (const auto& [nfa_state, kind] : machine.token_rules)
+        {
+            state_handlers[nfa_state + match_offset] = token_return(options.lang, options.token_kinds[static_cast<std::size_t>(kind)]);
+        }
+        auto& state_trailing = trailing.emplace_back();
+        for (const auto& [nfa_state, cut] : machine.trailing_rules)
+        {
+            state_trailing[nfa_state + match_offset] = cut;
+        }
+        auto& state_marks = marks.emplace_back(machine.trail_marks);
+        for (auto& marked : state_marks)
+        {
+            for (auto& nfa_state : marked)
+            {
+                nfa_state += match_offset;
+            }
+        }
+        match_offset += max_match + 1;
+
+        // same table prefixes as the per-STATE functions would get
+        const auto& fn_name = fn_names.emplace_back(i == 0 ? std::string(base_name) : std::format("{}_{}", base_name, states[i].name));
+
+        views.push_back({
+            .name = states[i].name,
+            .dfa =
+                dfa_view{
+                    .start_state = machine.start_state,
+                    .state_count = static_cast<std::size_t>(machine.get_state_count()),
+                    .transition_table = transition_table,
+                    .end_bitmask = machine.end_bitmask,
+                    .end_to_nfa_state = end_to_nfa_state,
+                    .handler_map = state_handlers,
+                    .rule_ids = machine.rule_ids,
+                    .batch_handlers = machine.batch_handlers,
+                    .token_rules = machine.token_rules,
+                    .trailing_rules = state_trailing,
+                    .trail_marks = state_marks,
+                    .memo_states = no_memo,
+                    .classes = merge_classes ? merged_classes : machine.classes,
+                    .fn_name = fn_name,
+                    .emit_prelude = i == 0,
+                },
+            .handle_error = states[i].handle_error,
+            .handle_internal_error = states[i].handle_internal_error,
+        });
+    }
+
+    return emit_cpp_states(out, views, inc, options);
+}
 
-        for (const auto& [nfa_state, handler] : dfa.handler_map)
+auto lexergen::dfa::find_newline_desync() const -> std::optional<dfa_warning>
+{
+    // Every state that consumes '\n' must land where the start state does: then a scan begun at any newline is in the same state as the
+    // true one right after it, so the two agree from the next token boundary on. "Where" means up to equivalence: without -O several
+    // states can do the same thing, so compare on the minimized DFA.
+    auto minimal = *this;
+    minimal.optimize(false);
+    const auto row_width = static_cast<int64_t>(minimal.classes.class_count()) + 1;
+    const auto newline_class = minimal.classes.classify('\n');
+    const auto sync_state = minimal.transition_table[static_cast<std::size_t>((minimal.start_state * row_width) + newline_class)];
+
+    for (int64_t s = 0; s < minimal.get_state_count(); s++)
+    {
+        auto t = minimal.transition_table[static_cast<std::size_t>((s * row_width) + newline_class)];
+        if (t != -1 && t != sync_state)
         {
-            out << std::format("        case {}: {}\n", nfa_state, handler);
+            return dfa_warning{
+                .state = s,
+                .detail = std::format("state {} consumes '\\n' into state {}, so a token can carry state across a newline", s, t),
+            };
         }
+    }
+    return std::nullopt;
+}
 
-        out << "        default:\n            " << handle_internal_error << "\n";
-        out << "        }\n\n";
-
-        out << "        latestMatch = -1;\n";
-        out << "        src.startToken();\n";
-        out << "        startBytes = src.bytes();\n";
-        out << std::format("        state = {};\n", dfa.start_state);
-        out << "        continue;\n    }\n";
-        out << "    }\n    }\n}\n";
+auto lexergen::dfa::linear_memo_states() const -> std::vector<int64_t>
+{
+    // The scan only rescans what it read after its last accept, all in non-accepting states reached from an accepting one without
+    // passing another. That region rescans without bound only through its cycles: peel off what no cycle leads into or out of, and
+    // whatever remains (cycles, and paths between them) is what the memo must cover.
+    const auto state_count = get_state_count();
+    const auto row_width = static_cast<int64_t>(classes.class_count()) + 1;
+    auto target = [&](int64_t s, int64_t c) { return transition_table[static_cast<std::size_t>((s * row_width) + c)]; };
 
-        return {.state_count = dfa.state_count, .case_count = total_cases};
+    std::vector<bool> region(static_cast<std::size_t>(state_count), false);
+    std::vector<int64_t> queue;
+    for (int64_t s = 0; s < state_count; s++)
+    {
+        if (end_bitmask[static_cast<std::size_t>(s)])
+        {
+            queue.push_back(s);
+        }
     }
-
-    auto describe_cp_plain(uint32_t cp) -> std::string
+    for (std::size_t qi = 0; qi < queue.size(); qi++)
     {
-        switch (cp)
+        for (int64_t c = 0; c < row_width; c++)
         {
-        case '\n':
-            return "\\n";
-        case '\r':
-            return "\\r";
-        case '\t':
-            return "\\t";
-        case '\0':
-            return "\\0";
-        case '\\':
-            return "\\\\";
-        default:
-            break;
+            auto t = target(queue[qi], c);
+            if (t == -1 || end_bitmask[static_cast<std::size_t>(t)] || region[static_cast<std::size_t>(t)])
+            {
+                continue;
+            }
+            region[static_cast<std::size_t>(t)] = true;
+            queue.push_back(t);
         }
+    }
 
-        if (cp >= 0x20 && cp < 0x7F)
+    std::vector<int64_t> in_degree(static_cast<std::size_t>(state_count), 0);
+    std::vector<int64_t> out_degree(static_cast<std::size_t>(state_count), 0);
+    std::vector<std::vector<int64_t>> preds(static_cast<std::size_t>(state_count));
+    std::vector<std::vector<int64_t>> succs(static_cast<std::size_t>(state_count));
+    for (int64_t s = 0; s < state_count; s++)
+    {
+        if (!region[static_cast<std::size_t>(s)])
         {
-            return std::string(1, static_cast<char>(cp));
+            continue;
         }
-        if (cp <= 0xFF)
+        for (int64_t c = 0; c < row_width; c++)
         {
-            return std::format("\\x{:02x}", cp);
+            auto t = target(s, c);
+            if (t == -1 || !region[static_cast<std::size_t>(t)])
+            {
+                continue;
+            }
+            succs[static_cast<std::size_t>(s)].push_back(t);
+            preds[static_cast<std::size_t>(t)].push_back(s);
+            out_degree[static_cast<std::size_t>(s)]++;
+            in_degree[static_cast<std::size_t>(t)]++;
         }
-        return std::format("U+{:04X}", cp);
     }
 
-    auto describe_interval_plain(lexergen::interval_set::codepoint lo, lexergen::interval_set::codepoint hi) -> std::string
+    auto peel = [&](std::vector<int64_t>& degree, const std::vector<std::vector<int64_t>>& next)
     {
-        if (lo == hi)
+        std::vector<int64_t> removed;
+        for (int64_t s = 0; s < state_count; s++)
         {
-            return describe_cp_plain(lo);
+            if (region[static_cast<std::size_t>(s)] && degree[static_cast<std::size_t>(s)] == 0)
+            {
+                removed.push_back(s);
+            }
+        }
+        for (std::size_t i = 0; i < removed.size(); i++)
+        {
+            region[static_cast<std::size_t>(removed[i])] = false;
+            for (auto t : next[static_cast<std::size_t>(removed[i])])
+            {
+                if (region[static_cast<std::size_t>(t)] && --degree[static_cast<std::size_t>(t)] == 0)
+                {
+                    removed.push_back(t);
+                }
+            }
         }
-        return std::format("{}-{}", describe_cp_plain(lo), describe_cp_plain(hi));
-    }
-
-} // namespace
-
-auto lexergen::dfa::codegen(
-    std::ostream& out, const std::string& inc, const std::string& handle_error, const std::string& handle_internal_error, target_lang lang,
-    std::string_view fn_name, bool emit_prelude, bool enable_simd
-) const -> codegen_result
-{
-    const dfa_view view{
-        .start_state = start_state,
-        .state_count = static_cast<std::size_t>(get_state_count()),
-        .transition_table = transition_table,
-        .end_bitmask = end_bitmask,
-        .end_to_nfa_state = end_to_nfa_state,
-        .handler_map = handler_map,
-        .classes = classes,
-        .fn_name = fn_name.empty() ? base_fn_name(lang) : fn_name,
-        .emit_prelude = emit_prelude,
     };
+    peel(in_degree, succs);
+    peel(out_degree, preds);
 
-    switch (lang)
+    std::vector<int64_t> result;
+    for (int64_t s = 0; s < state_count; s++)
     {
-    case target_lang::CPP:
-        return emit_cpp(out, view, inc, handle_error, handle_internal_error, enable_simd);
-    case target_lang::C:
-        return emit_c(out, view, inc, handle_error, handle_internal_error, enable_simd);
-    case target_lang::JAVA:
-        return emit_switch_loop(out, view, inc, handle_error, handle_internal_error, true);
-    case target_lang::JS:
-        return emit_switch_loop(out, view, inc, handle_error, handle_internal_error, false);
+        if (region[static_cast<std::size_t>(s)])
+        {
+            result.push_back(s);
+        }
     }
-
-    return {.state_count = 0, .case_count = 0};
+    return result;
 }
 
-auto lexergen::dfa::analyze_warnings(bool check_unmatchable, bool check_past_end) const -> dfa_warnings
+auto lexergen::dfa::analyze_warnings(bool check_unmatchable, bool check_past_end, bool check_backtrack) const -> dfa_warnings
 {
     dfa_warnings result;
     const auto state_count = get_state_count();
@@ -1061,6 +4060,11 @@ auto lexergen::dfa::analyze_warnings(bool check_unmatchable, bool check_past_end
         }
     }
 
+    if (check_backtrack)
+    {
+        analyze_backtrack(result);
+    }
+
     if (check_past_end)
     {
         auto zero_class = classes.classify(0);
@@ -1096,3 +4100,366 @@ auto lexergen::dfa::analyze_warnings(bool check_unmatchable, bool check_past_end
 
     return result;
 }
+
+void lexergen::dfa::analyze_backtrack(dfa_warnings& result) const
+{
+    // After an accept the scan reads on through states that don't accept, and backtracks to the accept if it fails among them. The
+    // longest such run from each of those states comes from peeling the region's sinks in turn, which visits them in reverse
+    // topological order; whatever never peels off can reach a loop, so its runs have no bound.
+    const auto state_count = get_state_count();
+    const auto row_width = static_cast<int64_t>(classes.class_count()) + 1;
+    auto target = [&](int64_t s, int64_t c) { return transition_table[static_cast<std::size_t>((s * row_width) + c)]; };
+    auto accepting = [&](int64_t s) -> bool { return end_bitmask[static_cast<std::size_t>(s)]; };
+    auto rule_of = [&](int64_t s) { return rule_ids.at(end_to_nfa_state[static_cast<std::size_t>(s)]); };
+    auto spell = [&](int64_t c)
+    {
+        auto iv = classes.class_interval(c);
+        return describe_cp_plain(example_cp(iv.lo, iv.hi));
+    };
+    // the examples try letters first, then other printable characters, so they read as text where they can
+    std::vector<int64_t> example_order;
+    for (int64_t c = 0; c + 1 < row_width; c++)
+    {
+        example_order.push_back(c);
+    }
+    std::ranges::stable_sort(
+        example_order, {},
+        [&](int64_t c)
+        {
+            auto iv = classes.class_interval(c);
+            auto cp = example_cp(iv.lo, iv.hi);
+            return cp < 0x80 && std::isalpha(static_cast<int>(cp)) != 0 ? 0 : cp >= 0x21 && cp <= 0x7E ? 1 : 2;
+        }
+    );
+
+    std::vector<bool> region(static_cast<std::size_t>(state_count), false);
+    std::vector<int64_t> queue;
+    for (int64_t s = 0; s < state_count; s++)
+    {
+        if (accepting(s))
+        {
+            queue.push_back(s);
+        }
+    }
+    for (std::size_t qi = 0; qi < queue.size(); qi++)
+    {
+        for (int64_t c = 0; c < row_width; c++)
+        {
+            auto t = target(queue[qi], c);
+            if (t != -1 && !accepting(t) && !region[static_cast<std::size_t>(t)])
+            {
+                region[static_cast<std::size_t>(t)] = true;
+                queue.push_back(t);
+            }
+        }
+    }
+
+    std::vector<std::vector<int64_t>> succs(static_cast<std::size_t>(state_count));
+    std::vector<std::vector<int64_t>> preds(static_cast<std::size_t>(state_count));
+    std::vector<int64_t> out_degree(static_cast<std::size_t>(state_count), 0);
+    for (int64_t s = 0; s < state_count; s++)
+    {
+        if (!region[static_cast<std::size_t>(s)])
+        {
+            continue;
+        }
+        auto& next = succs[static_cast<std::size_t>(s)];
+        for (int64_t c = 0; c < row_width; c++)
+        {
+            auto t = target(s, c);
+            if (t != -1 && region[static_cast<std::size_t>(t)] && std::ranges::find(next, t) == next.end())
+            {
+                next.push_back(t);
+                preds[static_cast<std::size_t>(t)].push_back(s);
+            }
+        }
+        out_degree[static_cast<std::size_t>(s)] = static_cast<int64_t>(next.size());
+    }
+
+    // bytes the scan can read from `s` on without accepting, counting the one that entered it; none: unbounded
+    std::vector<std::optional<int64_t>> longest(static_cast<std::size_t>(state_count));
+    std::vector<int64_t> sinks;
+    for (int64_t s = 0; s < state_count; s++)
+    {
+        if (region[static_cast<std::size_t>(s)] && out_degree[static_cast<std::size_t>(s)] == 0)
+        {
+            sinks.push_back(s);
+        }
+    }
+    for (std::size_t i = 0; i < sinks.size(); i++)
+    {
+        auto s = sinks[i];
+        int64_t after = 0;
+        for (auto t : succs[static_cast<std::size_t>(s)])
+        {
+            after = std::max(after, *longest[static_cast<std::size_t>(t)]);
+        }
+        longest[static_cast<std::size_t>(s)] = after + 1;
+        for (auto p : preds[static_cast<std::size_t>(s)])
+        {
+            if (--out_degree[static_cast<std::size_t>(p)] == 0)
+            {
+                sinks.push_back(p);
+            }
+        }
+    }
+
+    std::set<std::pair<int64_t, int64_t>> reported;
+    for (int64_t s = 0; s < state_count; s++)
+    {
+        if (!accepting(s))
+        {
+            continue;
+        }
+
+        std::optional<int64_t> max_bytes = 0;
+        for (int64_t c = 0; c < row_width && max_bytes; c++)
+        {
+            auto t = target(s, c);
+            if (t == -1 || accepting(t))
+            {
+                continue;
+            }
+            auto run = longest[static_cast<std::size_t>(t)];
+            max_bytes = run ? std::optional(std::max(*max_bytes, *run)) : std::nullopt;
+        }
+        result.rescan_bounds.push_back({.state = s, .rule = rule_of(s), .max_bytes = max_bytes});
+    }
+
+    // One unbounded rescan is linear; lexing is only quadratic when they repeat token after token. The input that does that is (from
+    // some point on) periodic, and each rescan goes around a loop of the region reading it, so the period is the word around that loop
+    // or a rotation of it. Take the shortest loop through each edge of the unbounded part as a candidate period. The token that
+    // rescans may also be the way into the loop (`/*` for a block comment that never closes), so also try each loop after the
+    // shortest input reaching a state that the scan enters right after an accept, if reading the loop on from there stays unbounded.
+    auto unbounded = [&](int64_t s) { return s != -1 && region[static_cast<std::size_t>(s)] && !longest[static_cast<std::size_t>(s)]; };
+    std::vector<std::vector<std::pair<int64_t, int64_t>>> loop_preds(static_cast<std::size_t>(state_count));
+    for (int64_t s = 0; s < state_count; s++)
+    {
+        for (auto c : example_order)
+        {
+            if (unbounded(s) && unbounded(target(s, c)))
+            {
+                loop_preds[static_cast<std::size_t>(target(s, c))].emplace_back(s, c);
+            }
+        }
+    }
+    std::vector<std::vector<int64_t>> reach_input(static_cast<std::size_t>(state_count));
+    std::vector<bool> reached(static_cast<std::size_t>(state_count), false);
+    std::vector<int64_t> bfs{start_state};
+    reached[static_cast<std::size_t>(start_state)] = true;
+    for (std::size_t qi = 0; qi < bfs.size(); qi++)
+    {
+        for (auto c : example_order)
+        {
+            auto t = target(bfs[qi], c);
+            if (t != -1 && !reached[static_cast<std::size_t>(t)])
+            {
+                reached[static_cast<std::size_t>(t)] = true;
+                reach_input[static_cast<std::size_t>(t)] = reach_input[static_cast<std::size_t>(bfs[qi])];
+                reach_input[static_cast<std::size_t>(t)].push_back(c);
+                bfs.push_back(t);
+            }
+        }
+    }
+    std::set<std::vector<int64_t>> loops;
+    std::set<std::vector<int64_t>> periods;
+    auto add_period = [&](std::vector<int64_t> word)
+    {
+        auto first = word;
+        for (std::size_t i = 1; i < word.size(); i++)
+        {
+            std::ranges::rotate(word, word.begin() + 1);
+            first = std::min(first, word);
+        }
+        periods.insert(std::move(first));
+    };
+    for (int64_t r = 0; r < state_count; r++)
+    {
+        if (!unbounded(r))
+        {
+            continue;
+        }
+        // shortest way back to r from each state: the class to read and the state it leads to
+        std::vector<std::pair<int64_t, int64_t>> back(static_cast<std::size_t>(state_count), {-1, -1});
+        std::vector<int64_t> from{r};
+        for (std::size_t qi = 0; qi < from.size(); qi++)
+        {
+            for (auto [p, c] : loop_preds[static_cast<std::size_t>(from[qi])])
+            {
+                if (p != r && back[static_cast<std::size_t>(p)].first == -1)
+                {
+                    back[static_cast<std::size_t>(p)] = {c, from[qi]};
+                    from.push_back(p);
+                }
+            }
+        }
+        for (auto c : example_order)
+        {
+            auto t = target(r, c);
+            if (!unbounded(t) || (t != r && back[static_cast<std::size_t>(t)].first == -1))
+            {
+                continue;
+            }
+            std::vector<int64_t> word{c};
+            for (; t != r; t = back[static_cast<std::size_t>(t)].second)
+            {
+                word.push_back(back[static_cast<std::size_t>(t)].first);
+            }
+            loops.insert(word);
+            add_period(std::move(word));
+        }
+    }
+    std::set<int64_t> entries;
+    for (int64_t s = 0; s < state_count; s++)
+    {
+        for (int64_t c = 0; c < row_width && accepting(s); c++)
+        {
+            if (unbounded(target(s, c)))
+            {
+                entries.insert(target(s, c));
+            }
+        }
+    }
+    for (auto t : entries)
+    {
+        for (const auto& word : loops)
+        {
+            const auto len = word.size();
+            std::vector<bool> seen(static_cast<std::size_t>(state_count) * len, false);
+            auto s = t;
+            for (std::size_t i = 0; unbounded(s) && !seen[(static_cast<std::size_t>(s) * len) + (i % len)]; i++)
+            {
+                seen[(static_cast<std::size_t>(s) * len) + (i % len)] = true;
+                s = target(s, word[i % len]);
+            }
+            if (unbounded(s))
+            {
+                auto entered = reach_input[static_cast<std::size_t>(t)];
+                entered.insert(entered.end(), word.begin(), word.end());
+                add_period(std::move(entered));
+            }
+        }
+    }
+
+    // Lex each period repeated forever, from each offset into it: the token found there, and whether the scan for it read on to the end
+    struct token_run
+    {
+        // none: the token takes the rest of the input, or nothing matches
+        std::optional<int64_t> length;
+        int64_t accept_state = -1;
+        // the state the scan loops in after its last accept, or -1 if it fails before the end
+        int64_t loop_state = -1;
+    };
+    // shortest first, so each rule pair is reported with the shortest period found for it
+    std::vector<std::vector<int64_t>> by_length(periods.begin(), periods.end());
+    std::ranges::stable_sort(by_length, {}, &std::vector<int64_t>::size);
+    for (const auto& period : by_length)
+    {
+        const auto len = static_cast<int64_t>(period.size());
+        auto lex_from = [&](int64_t offset)
+        {
+            token_run run;
+            std::map<std::pair<int64_t, int64_t>, int64_t> seen_at;
+            int64_t last_accept = 0;
+            for (int64_t i = 0, s = start_state;; s = target(s, period[static_cast<std::size_t>((offset + i++) % len)]))
+            {
+                if (s == -1)
+                {
+                    break;
+                }
+                auto [at, fresh] = seen_at.emplace(std::pair(s, (offset + i) % len), i);
+                if (!fresh)
+                {
+                    // around the loop from here until the input ends, backtracking to the last accept unless it is on the loop
+                    run.loop_state = last_accept < at->second ? s : -1;
+                    if (run.loop_state == -1)
+                    {
+                        return run;
+                    }
+                    break;
+                }
+                if (i > 0 && accepting(s))
+                {
+                    last_accept = i;
+                    run.accept_state = s;
+                }
+            }
+            if (last_accept > 0)
+            {
+                run.length = last_accept;
+            }
+            return run;
+        };
+
+        std::vector<token_run> runs;
+        for (int64_t offset = 0; offset < len; offset++)
+        {
+            runs.push_back(lex_from(offset));
+        }
+        for (int64_t offset = 0; offset < len; offset++)
+        {
+            const auto& run = runs[static_cast<std::size_t>(offset)];
+            if (run.loop_state == -1 || !run.length)
+            {
+                continue;
+            }
+            // quadratic if lexing from after this token comes back to this offset, so the rescan recurs every period
+            auto next = offset;
+            for (int64_t step = 0; step < len; step++)
+            {
+                auto length = runs[static_cast<std::size_t>(next)].length;
+                next = length ? (next + *length) % len : -1;
+                if (next == -1 || next == offset)
+                {
+                    break;
+                }
+            }
+            if (next != offset)
+            {
+                continue;
+            }
+
+            // the rules the scan is reading on for: whatever it can still accept from the loop
+            std::set<int64_t> pursued;
+            std::vector<bool> seen(static_cast<std::size_t>(state_count), false);
+            std::vector<int64_t> from{run.loop_state};
+            seen[static_cast<std::size_t>(run.loop_state)] = true;
+            for (std::size_t qi = 0; qi < from.size(); qi++)
+            {
+                for (int64_t c = 0; c < row_width; c++)
+                {
+                    auto t = target(from[qi], c);
+                    if (t == -1 || seen[static_cast<std::size_t>(t)])
+                    {
+                        continue;
+                    }
+                    if (accepting(t))
+                    {
+                        pursued.insert(rule_of(t));
+                        continue;
+                    }
+                    seen[static_cast<std::size_t>(t)] = true;
+                    from.push_back(t);
+                }
+            }
+            if (pursued.empty())
+            {
+                pursued.insert(-1);
+            }
+
+            std::string unit;
+            for (int64_t i = 0; i < len; i++)
+            {
+                unit += spell(period[static_cast<std::size_t>((offset + i) % len)]);
+            }
+            for (auto rule : pursued)
+            {
+                auto accepted = rule_of(run.accept_state);
+                if (reported.emplace(accepted, rule).second)
+                {
+                    result.quadratic.push_back({.state = run.accept_state, .accepted_rule = accepted, .pursued_rule = rule, .period = unit});
+                }
+            }
+        }
+    }
+}
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <list>
 #include <queue>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -150,6 +151,21 @@ auto lexergen::nfa_builder::build() -> dfa
         }
     }
 
+    if (!trail_marks.empty())
+    {
+        ret.trail_marks.resize(static_cast<std::size_t>(curr_node_id));
+        for (const auto& entry : subset_to_id)
+        {
+            for (const auto& [node, end_node] : trail_marks)
+            {
+                if (entry.first[node])
+                {
+                    ret.trail_marks[entry.second].push_back(end_node);
+                }
+            }
+        }
+    }
+
     const int64_t dfa_row_width = class_count + 1; // +1: sentinel "no class" column, see dfa.h
     for (const auto& edge : output_edges)
     {
@@ -158,3 +174,101 @@ auto lexergen::nfa_builder::build() -> dfa
 
     return ret;
 }
+
+auto lexergen::nfa_builder::trailing_ambiguous(int64_t r_start, int64_t r_end, int64_t s_start, int64_t s_end) const -> bool
+{
+    const int64_t nodes = max_val + 1;
+    std::vector<std::vector<int64_t>> epsilon_out(nodes);
+    std::vector<std::vector<int64_t>> epsilon_in(nodes);
+    std::vector<std::vector<entry>> edges_out(nodes);
+    std::vector<std::vector<int64_t>> edges_in(nodes);
+    for (const auto& [from, to] : epsilon_edges)
+    {
+        epsilon_out[from].push_back(to);
+        epsilon_in[to].push_back(from);
+    }
+    for (const auto& edge : edges)
+    {
+        edges_out[edge.from].push_back(edge);
+        edges_in[edge.to].push_back(edge.from);
+    }
+
+    auto flood = [&](int64_t from, const std::vector<std::vector<int64_t>>& eps, const auto& next_of)
+    {
+        std::vector<bool> seen(nodes);
+        std::queue<int64_t> to_process;
+        to_process.push(from);
+        seen[from] = true;
+        while (!to_process.empty())
+        {
+            auto curr = to_process.front();
+            to_process.pop();
+            auto visit = [&](int64_t next)
+            {
+                if (!seen[next])
+                {
+                    seen[next] = true;
+                    to_process.push(next);
+                }
+            };
+            std::ranges::for_each(eps[curr], visit);
+            next_of(curr, visit);
+        }
+        return seen;
+    };
+
+    // s is built after r, so everything reachable from its start belongs to it; of that, keep what can still reach its end
+    auto in_s = flood(s_start, epsilon_out, [&](int64_t node, const auto& visit) {
+        for (const auto& edge : edges_out[node])
+        {
+            visit(edge.to);
+        }
+    });
+    auto to_s_end = flood(s_end, epsilon_in, [&](int64_t node, const auto& visit) { std::ranges::for_each(edges_in[node], visit); });
+
+    // walk r·s (a) and r alone (b) over the same input; (a, b, consumed in s) is encoded as one key
+    std::unordered_set<int64_t> seen;
+    std::queue<std::tuple<int64_t, int64_t, bool>> to_process;
+    auto visit = [&](int64_t a, int64_t b, bool consumed)
+    {
+        if (seen.insert((((a * nodes) + b) * 2) + (consumed ? 1 : 0)).second)
+        {
+            to_process.emplace(a, b, consumed);
+        }
+    };
+    visit(r_start, r_start, false);
+
+    while (!to_process.empty())
+    {
+        auto [a, b, consumed] = to_process.front();
+        to_process.pop();
+        if (consumed && b == r_end && in_s[a] && to_s_end[a])
+        {
+            return true;
+        }
+
+        for (auto next : epsilon_out[a])
+        {
+            visit(next, b, consumed);
+        }
+        for (auto next : epsilon_out[b])
+        {
+            if (b != r_end || next != s_start)
+            {
+                visit(a, next, consumed);
+            }
+        }
+        for (const auto& edge_a : edges_out[a])
+        {
+            for (const auto& edge_b : edges_out[b])
+            {
+                if (edge_a.class_id == edge_b.class_id)
+                {
+                    visit(edge_a.to, edge_b.to, consumed || in_s[a]);
+                }
+            }
+        }
+    }
+
+    return false;
+}
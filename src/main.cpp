@@ -5,10 +5,13 @@
 #include "machine/dfa.h"
 #include "machine/nfa.h"
 #include "regex.h"
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <span>
 #include <string>
 #include <string_view>
@@ -51,6 +54,127 @@ namespace
         return {word, rest};
     }
 
+    auto parse_priority(std::string_view str) -> std::optional<int64_t>
+    {
+        auto digits = str.starts_with('-') ? str.substr(1) : str;
+        if (digits.empty() || digits.find_first_not_of("0123456789") != std::string_view::npos)
+        {
+            return std::nullopt;
+        }
+        return std::stoll(std::string(str));
+    }
+
+    auto is_identifier(std::string_view str) -> bool
+    {
+        auto is_start = [](char ch) { return ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'); };
+        auto is_continue = [&](char ch) { return is_start(ch) || (ch >= '0' && ch <= '9'); };
+        return !str.empty() && is_start(str[0]) && std::ranges::all_of(str.substr(1), is_continue);
+    }
+
+    // BEGIN(name), PUSH(name) and POP() in a handler become calls on the lex_states the merged lex_tok takes; nullopt if the handler
+    // has none. Anything else is the handler's own code and copied as-is: string and character literals, members and qualified names
+    // (`ctx.PUSH(3)`, `util::BEGIN(x)`), and calls whose argument isn't a STATE.
+    auto rewrite_state_actions(std::string_view handler, std::span<const std::string> state_names) -> std::optional<std::string>
+    {
+        auto is_word_char = [](char ch) { return ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9'); };
+
+        std::string result;
+        bool rewritten = false;
+        std::size_t i = 0;
+        while (i < handler.size())
+        {
+            if (handler[i] == '"' || handler[i] == '\'')
+            {
+                auto quote = handler[i];
+                auto end = i + 1;
+                while (end < handler.size() && handler[end] != quote)
+                {
+                    end += handler[end] == '\\' ? 2 : 1;
+                }
+                end = std::min(end + 1, handler.size());
+                result += handler.substr(i, end - i);
+                i = end;
+                continue;
+            }
+
+            if (!is_word_char(handler[i]))
+            {
+                result += handler[i++];
+                continue;
+            }
+
+            auto word_end = i;
+            while (word_end < handler.size() && is_word_char(handler[word_end]))
+            {
+                word_end++;
+            }
+            auto word = handler.substr(i, word_end - i);
+            auto before = trim(handler.substr(0, i));
+            bool qualified = before.ends_with('.') || before.ends_with("->") || before.ends_with("::");
+            auto open = handler.find_first_not_of(" \t", word_end);
+            bool is_action =
+                !qualified && (word == "BEGIN" || word == "PUSH" || word == "POP") && open != std::string_view::npos && handler[open] == '(';
+            auto close = is_action ? handler.find(')', open) : std::string_view::npos;
+            auto arg = close == std::string_view::npos ? std::string_view() : trim(handler.substr(open + 1, close - open - 1));
+            bool takes_state = word != "POP";
+            if (close == std::string_view::npos || takes_state != !arg.empty() ||
+                (takes_state && std::ranges::find(state_names, arg) == state_names.end()))
+            {
+                result += word;
+                i = word_end;
+                continue;
+            }
+
+            result += takes_state ? std::format("lex_state.{}(lex_state_id::{})", word == "BEGIN" ? "begin" : "push", arg) : "lex_state.pop()";
+            rewritten = true;
+            i = close + 1;
+        }
+
+        if (!rewritten)
+        {
+            return std::nullopt;
+        }
+        return result;
+    }
+
+    // whether `word` appears in the handler as a whole word outside string and character literals
+    auto mentions_word(std::string_view handler, std::string_view word) -> bool
+    {
+        auto is_word_char = [](char ch) { return ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9'); };
+
+        std::size_t i = 0;
+        while (i < handler.size())
+        {
+            if (handler[i] == '"' || handler[i] == '\'')
+            {
+                auto quote = handler[i++];
+                while (i < handler.size() && handler[i] != quote)
+                {
+                    i += handler[i] == '\\' ? 2 : 1;
+                }
+                i++;
+                continue;
+            }
+
+            auto word_end = i;
+            while (word_end < handler.size() && is_word_char(handler[word_end]))
+            {
+                word_end++;
+            }
+            if (word_end == i)
+            {
+                i++;
+                continue;
+            }
+            if (handler.substr(i, word_end - i) == word)
+            {
+                return true;
+            }
+            i = word_end;
+        }
+        return false;
+    }
+
     auto get_str_section(std::istream& stream) -> std::string
     {
         std::string buf;
@@ -124,6 +248,93 @@ inline static constexpr lexergen::option options[] = {
         .has_args = false,
         .required = false,
     },
+    {
+        .name = "sentinel",
+        .long_flag = "--sentinel",
+        .short_flag = "-z",
+        .description = "(cpp/c targets) assume the input ends in a NUL sentinel and drop per-byte bounds checks; needs a raw-cursor Source",
+        .has_args = false,
+        .required = false,
+    },
+    {
+        .name = "track-lines",
+        .long_flag = "--track-lines",
+        .short_flag = "-L",
+        .description = "(cpp target) count lines while scanning: handlers get start_line/start_column, and the Source keeps line()/line_start(); "
+                       "needs a raw-cursor Source with set_line()",
+        .has_args = false,
+        .required = false,
+    },
+    {
+        .name = "batch",
+        .long_flag = "--batch",
+        .short_flag = "-B",
+        .description = "(cpp/c targets) also emit lex_batch(), which fills kind/start/end arrays without running handlers (see RULE HANDLE)",
+        .has_args = false,
+        .required = false,
+    },
+    {
+        .name = "parallel",
+        .long_flag = "--parallel",
+        .short_flag = "-P",
+        .description = "(cpp target) also emit lex_parallel(), which lexes one buffer on several threads; implies --batch, and needs a grammar "
+                       "that resynchronizes at newlines (or SYNC_SAFE)",
+        .has_args = false,
+        .required = false,
+    },
+    {
+        .name = "incremental",
+        .long_flag = "--incremental",
+        .short_flag = "-I",
+        .description = "(cpp target) also emit lex_incremental(), which keeps a lexgen_incremental::document of tokens up to date across "
+                       "edits by re-lexing only around them",
+        .has_args = false,
+        .required = false,
+    },
+    {
+        .name = "push",
+        .long_flag = "--push",
+        .short_flag = "-R",
+        .description = "(cpp target) also emit lex_push(), which lexes input fed in chunks through a lexgen_push::stream and runs the "
+                       "NEED_MORE handler when a chunk runs out mid-token",
+        .has_args = false,
+        .required = false,
+    },
+    {
+        .name = "coroutine",
+        .long_flag = "--coroutine",
+        .short_flag = "-C",
+        .description = "(cpp target) also emit lex_stream(), a C++20 coroutine yielding tokens from a source whose refill() is awaited; "
+                       "implies --push",
+        .has_args = false,
+        .required = false,
+    },
+    {
+        .name = "merge-states",
+        .long_flag = "--merge-states",
+        .short_flag = "-M",
+        .description = "(cpp target) emit every STATE into one lex_tok(src, ctx, state) taking a lex_state_id, sharing the FAIL tail and "
+                       "class table, instead of one lex_tok_<name> per STATE",
+        .has_args = false,
+        .required = false,
+    },
+    {
+        .name = "linear",
+        .long_flag = "--linear",
+        .short_flag = "-T",
+        .description = "(cpp target) guarantee linear-time longest match: lex_tok takes a lexgen_linear::memo of failed (state, position) "
+                       "pairs and never rescans past one; grammars whose rescans are bounded don't use it; needs a raw-cursor Source",
+        .has_args = false,
+        .required = false,
+    },
+    {
+        .name = "utf8",
+        .long_flag = "--utf8",
+        .short_flag = "-u",
+        .description = "compile charsets to UTF-8 byte sequences: the DFA matches bytes (SIMD-friendly) and negation covers all of Unicode",
+        .has_args = false,
+        .required = false,
+    },
     {
         .name = "warn-unmatchable-token",
         .long_flag = "--warn-unmatchable-token",
@@ -140,6 +351,15 @@ inline static constexpr lexergen::option options[] = {
         .has_args = false,
         .required = false,
     },
+    {
+        .name = "warn-quadratic-backtrack",
+        .long_flag = "--warn-quadratic-backtrack",
+        .short_flag = "-Wquadratic-backtrack",
+        .description = "warn about rule pairs where the scan can read on without bound past a match and then backtrack to it, so lexing "
+                       "can take quadratic time (with an example input; --debug also prints the bound for every accepting state)",
+        .has_args = false,
+        .required = false,
+    },
     {
         .name = "warn-all",
         .long_flag = "--warn-all",
@@ -176,21 +396,29 @@ auto main(int argc, const char* argv[]) -> int
     // The file format is defined as:
     // [preamble]
     // %%
-    // RULE [priority] /expr/ [handler]
+    // RULE [priority] [HANDLE] /expr/ [handler]
+    // RULE [priority] [HANDLE] /expr/trailing/ [handler]
+    // TOKEN [priority] NAME [/expr/]
     // UNKNOWN [handler]
     // ERROR [handler]
+    // NEED_MORE [handler]  (mandatory with --push)
     // MACRO name /expr/
+    // SYNC_SAFE
     // STATE name {
-    //     RULE [priority] /expr/ [handler]
+    //     RULE [priority] [HANDLE] /expr/ [handler]
+    //     TOKEN [priority] NAME [/expr/]
     //     UNKNOWN [handler]  (optional, overrides the top-level one for this STATE)
     //     ERROR [handler]    (optional, overrides the top-level one for this STATE)
+    //     NEED_MORE [handler] (optional, overrides the top-level one for this STATE)
+    //     SYNC_SAFE          (optional, applies to this STATE only)
     //     ...
     // }
     // %%
     // [epilogue]
     //
     // UNKNOWN/ERROR are mandatory at the top level; a STATE block that doesn't
-    // declare its own falls back to the top-level handler.
+    // declare its own falls back to the top-level handler. Handlers may switch
+    // STATE with BEGIN(name)/PUSH(name)/POP(), the top level being INITIAL.
 
     std::string preamble = get_str_section(in_file);
     using rule_table = std::vector<lexergen::rule_def>;
@@ -199,16 +427,24 @@ auto main(int argc, const char* argv[]) -> int
     {
         std::string name;
         rule_table tokens;
+        // the source line of each entry in `tokens`, for diagnostics
+        std::vector<std::string> rule_lines;
         std::string handle_error;
         bool has_unknown = false;
         std::string handle_internal_error;
         bool has_error = false;
+        std::string handle_need_more;
+        bool has_need_more = false;
+        // asserted by the grammar: lexing restarted at a newline agrees with the true token stream soon after
+        bool sync_safe = false;
     };
 
     std::vector<state_entry> state_tables{{.name = ""}};
     std::string current_state;
     std::size_t current_index = 0;
-    lexergen::macro_table macros = lexergen::builtin_macros();
+    const lexergen::regex_options regex_options{.utf8 = args["utf8"].present};
+    lexergen::macro_table macros = lexergen::builtin_macros(regex_options);
+    std::vector<std::string> token_kinds;
 
     std::string line;
 
@@ -281,17 +517,28 @@ auto main(int argc, const char* argv[]) -> int
                 exit(-1);
             }
 
-            auto [success, expr, error_msg, macro_rest] = lexergen::parse_regex(std::string(expr_str), macros);
+            auto [success, expr, trailing, error_msg, macro_rest] = lexergen::parse_regex(std::string(expr_str), macros, regex_options);
             if (!success)
             {
                 std::cerr << std::format("failed to parse macro `{}`: {}\n", name, error_msg);
                 exit(-1);
             }
+            if (trailing)
+            {
+                std::cerr << std::format("macro `{}` can't have trailing context; put it on the rule instead\n", name);
+                exit(-1);
+            }
 
             macros[std::string(name)] = expr;
             continue;
         }
 
+        if (word == "SYNC_SAFE" && directive_rest.empty())
+        {
+            state_tables[current_index].sync_safe = true;
+            continue;
+        }
+
         if (word == "UNKNOWN")
         {
             state_tables[current_index].handle_error = std::string(directive_rest);
@@ -299,6 +546,13 @@ auto main(int argc, const char* argv[]) -> int
             continue;
         }
 
+        if (word == "NEED_MORE")
+        {
+            state_tables[current_index].handle_need_more = std::string(directive_rest);
+            state_tables[current_index].has_need_more = true;
+            continue;
+        }
+
         if (word == "ERROR")
         {
             state_tables[current_index].handle_internal_error = std::string(directive_rest);
@@ -307,21 +561,75 @@ auto main(int argc, const char* argv[]) -> int
         }
 
         int64_t priority = 0;
+        bool batch_handler = false;
         std::string_view rule_line = trimmed;
 
+        if (word == "TOKEN")
+        {
+            rule_line = directive_rest;
+            auto [maybe_priority, after_priority] = split_first_word(rule_line);
+            if (auto parsed = parse_priority(maybe_priority))
+            {
+                priority = *parsed;
+                rule_line = after_priority;
+            }
+
+            auto [name, expr_str] = split_first_word(rule_line);
+            if (!is_identifier(name))
+            {
+                std::cerr << std::format("malformed line `{}`: expected `TOKEN [priority] NAME [/expr/]`\n", line);
+                exit(-1);
+            }
+
+            auto kind_it = std::ranges::find(token_kinds, name);
+            auto kind = static_cast<int64_t>(kind_it - token_kinds.begin());
+            if (kind_it == token_kinds.end())
+            {
+                token_kinds.emplace_back(name);
+            }
+
+            // a bare `TOKEN NAME` only declares the kind, e.g. for UNKNOWN or a hand-written rule to return
+            if (expr_str.empty())
+            {
+                continue;
+            }
+
+            auto [success, expr, trailing, error_msg, rest] = lexergen::parse_regex(std::string(expr_str), macros, regex_options);
+            if (!success)
+            {
+                std::cerr << std::format("failed to parse line `{}`: {}\n", line, error_msg);
+                exit(-1);
+            }
+            if (!trim(rest).empty())
+            {
+                std::cerr << std::format("malformed line `{}`: TOKEN rules take no handler (use RULE instead)\n", line);
+                exit(-1);
+            }
+
+            tokens.push_back({.expr = expr, .priority = priority, .trailing = trailing, .token_kind = kind});
+            state_tables[current_index].rule_lines.emplace_back(trimmed);
+            continue;
+        }
+
         if (word == "RULE")
         {
             rule_line = directive_rest;
             auto [maybe_priority, after_priority] = split_first_word(rule_line);
-            auto digits = maybe_priority.starts_with('-') ? maybe_priority.substr(1) : maybe_priority;
-            if (!digits.empty() && digits.find_first_not_of("0123456789") == std::string_view::npos)
+            if (auto parsed = parse_priority(maybe_priority))
             {
-                priority = std::stoll(std::string(maybe_priority));
+                priority = *parsed;
                 rule_line = after_priority;
             }
+
+            auto [maybe_handle, after_handle] = split_first_word(rule_line);
+            if (maybe_handle == "HANDLE")
+            {
+                batch_handler = true;
+                rule_line = after_handle;
+            }
         }
 
-        auto [success, expr, error_msg, handler] = lexergen::parse_regex(std::string(rule_line), macros);
+        auto [success, expr, trailing, error_msg, handler] = lexergen::parse_regex(std::string(rule_line), macros, regex_options);
 
         if (!success)
         {
@@ -329,7 +637,8 @@ auto main(int argc, const char* argv[]) -> int
             exit(-1);
         }
 
-        tokens.push_back({.expr = expr, .handler = handler, .priority = priority});
+        tokens.push_back({.expr = expr, .handler = handler, .priority = priority, .trailing = trailing, .batch_handler = batch_handler});
+        state_tables[current_index].rule_lines.emplace_back(trimmed);
     }
 
     if (!current_state.empty())
@@ -354,6 +663,41 @@ auto main(int argc, const char* argv[]) -> int
         {
             state_tables[i].handle_internal_error = state_tables[0].handle_internal_error;
         }
+        if (!state_tables[i].has_need_more)
+        {
+            state_tables[i].handle_need_more = state_tables[0].handle_need_more;
+        }
+    }
+
+    // BEGIN/PUSH/POP name the top level INITIAL
+    std::vector<std::string> state_names;
+    for (const auto& entry : state_tables)
+    {
+        state_names.push_back(entry.name.empty() ? std::string("INITIAL") : entry.name);
+    }
+
+    // only a grammar with STATE blocks has states to switch between; anywhere else these names are the handler's own
+    bool state_actions = false;
+    auto rewrite_handler = [&](std::string& handler)
+    {
+        if (state_tables.size() < 2)
+        {
+            return;
+        }
+        if (auto rewritten = rewrite_state_actions(handler, state_names))
+        {
+            handler = std::move(*rewritten);
+            state_actions = true;
+        }
+    };
+    for (auto& entry : state_tables)
+    {
+        for (auto& rule : entry.tokens)
+        {
+            rewrite_handler(rule.handler);
+        }
+        rewrite_handler(entry.handle_error);
+        rewrite_handler(entry.handle_internal_error);
     }
 
     std::string file_end = get_str_section(in_file);
@@ -374,9 +718,106 @@ auto main(int argc, const char* argv[]) -> int
         lang = *inferred;
     }
 
+    // options the java and javascript (and some the c) targets don't implement; generating without them would quietly drop them
+    struct target_option
+    {
+        std::string_view name;
+        std::string_view flag;
+        bool c_too;
+    };
+    for (const auto& option : {
+             target_option{.name = "sentinel", .flag = "--sentinel", .c_too = true},
+             target_option{.name = "batch", .flag = "--batch", .c_too = true},
+             target_option{.name = "track-lines", .flag = "--track-lines", .c_too = false},
+             target_option{.name = "parallel", .flag = "--parallel", .c_too = false},
+             target_option{.name = "incremental", .flag = "--incremental", .c_too = false},
+             target_option{.name = "push", .flag = "--push", .c_too = false},
+             target_option{.name = "coroutine", .flag = "--coroutine", .c_too = false},
+             target_option{.name = "merge-states", .flag = "--merge-states", .c_too = false},
+         })
+    {
+        if (args[std::string(option.name)].present && lang != lexergen::target_lang::CPP && !(option.c_too && lang == lexergen::target_lang::C))
+        {
+            std::cerr << std::format("{} is only supported by the {}\n", option.flag, option.c_too ? "cpp and c targets" : "cpp target");
+            exit(-1);
+        }
+    }
+
     const bool enable_simd = args["simd"].present;
+    const bool sentinel = args["sentinel"].present;
+    const bool track_lines = args["track-lines"].present;
+    const bool parallel = args["parallel"].present;
+    const bool incremental = args["incremental"].present;
+    const bool coroutine = args["coroutine"].present;
+    const bool push = args["push"].present || coroutine;
+    if (push && !state_tables[0].has_need_more)
+    {
+        std::cerr << "--push needs a NEED_MORE handler directive\n";
+        exit(-1);
+    }
+    const bool batch = args["batch"].present || parallel;
+    // lex_batch runs HANDLE handlers inline, so a `return` there would leave it with the handler's value as the token count
+    for (const auto& entry : state_tables)
+    {
+        for (std::size_t i = 0; i < entry.tokens.size(); i++)
+        {
+            if (batch && entry.tokens[i].batch_handler && mentions_word(entry.tokens[i].handler, "return"))
+            {
+                std::cerr << std::format(
+                    "`{}`: a HANDLE handler can't `return` with --batch or --parallel; end it with `break;`\n", entry.rule_lines[i]
+                );
+                exit(-1);
+            }
+        }
+    }
+    // BEGIN/PUSH/POP need every STATE in one function; --merge-states asks for it
+    const bool merge_states = state_actions || args["merge-states"].present;
+    const auto merge_reason = state_actions ? std::string_view("BEGIN/PUSH/POP actions") : std::string_view("--merge-states");
+    const bool linear = args["linear"].present;
+    if (linear && (lang != lexergen::target_lang::CPP || batch || incremental || push))
+    {
+        std::cerr << "--linear is only supported by the cpp target, without --batch, --parallel, --incremental, --push or --coroutine\n";
+        exit(-1);
+    }
+    if (state_actions && lang != lexergen::target_lang::CPP)
+    {
+        std::cerr << "BEGIN/PUSH/POP actions are only supported by the cpp target\n";
+        exit(-1);
+    }
+    if (merge_states)
+    {
+        if (batch || incremental || push || linear)
+        {
+            std::cerr << std::format("{} can't be combined with --batch, --parallel, --incremental, --push, --coroutine or --linear\n", merge_reason);
+            exit(-1);
+        }
+        if (std::ranges::count(state_names, "INITIAL") > 1)
+        {
+            std::cerr << std::format("STATE `INITIAL` is reserved for the top level with {}\n", merge_reason);
+            exit(-1);
+        }
+    }
+    // `/r/s/` needs the raw-cursor scanner, which only the cpp and c targets have, and which --push/--track-lines replace
+    const bool trailing_context = std::ranges::any_of(
+        state_tables,
+        [](const state_entry& entry) { return std::ranges::any_of(entry.tokens, [](const auto& rule) { return rule.trailing != nullptr; }); }
+    );
+    if (trailing_context)
+    {
+        if (lang != lexergen::target_lang::CPP && lang != lexergen::target_lang::C)
+        {
+            std::cerr << "trailing context (/r/s/) is only supported by the cpp and c targets\n";
+            exit(-1);
+        }
+        if (push || track_lines)
+        {
+            std::cerr << "trailing context (/r/s/) can't be combined with --push, --coroutine or --track-lines\n";
+            exit(-1);
+        }
+    }
     const bool warn_unmatchable = args["warn-unmatchable-token"].present || args["warn-all"].present;
     const bool warn_past_end = args["warn-past-the-end"].present || args["warn-all"].present;
+    const bool warn_backtrack = args["warn-quadratic-backtrack"].present || args["warn-all"].present;
 
     std::ofstream out(args["cpp-out"].value);
     if (!out)
@@ -395,33 +836,161 @@ auto main(int argc, const char* argv[]) -> int
     {
         const auto& entry = state_tables[i];
         auto fn_name = entry.name.empty() ? base_fn_name : base_fn_name + "_" + entry.name;
+        auto batch_fn_name = !batch ? std::string() : entry.name.empty() ? std::string("lex_batch") : "lex_batch_" + entry.name;
 
         auto [dfa, nfa] = lexergen::make_lexer(entry.tokens);
 
+        if (!dfa.get_ambiguous_trailing().empty())
+        {
+            for (auto rule : dfa.get_ambiguous_trailing())
+            {
+                std::cerr << std::format(
+                    "dangerous trailing context in `{}`: r can match again inside the trailing part, so where it ends is ambiguous; make r or "
+                    "the trailing part fixed-length\n",
+                    entry.rule_lines[static_cast<std::size_t>(rule)]
+                );
+            }
+            exit(-1);
+        }
+
         if (args["optimize"].present)
         {
             dfa.optimize(args["debug"].present);
         }
 
-        auto res = dfa.codegen(out, preamble, entry.handle_error, entry.handle_internal_error, lang, fn_name, i == 0, enable_simd);
+        auto push_fn_name = !push ? std::string() : entry.name.empty() ? std::string("lex_push") : "lex_push_" + entry.name;
+        auto stream_fn_name = !coroutine ? std::string() : entry.name.empty() ? std::string("lex_stream") : "lex_stream_" + entry.name;
+        if (push && dfa.get_classes().max_codepoint() > 0xFF)
+        {
+            std::cerr << std::format("--push needs a byte-level DFA, but `{}` matches codepoints above 0xFF; add --utf8\n", fn_name);
+            exit(-1);
+        }
+
+        auto parallel_fn_name = !parallel ? std::string() : entry.name.empty() ? std::string("lex_parallel") : "lex_parallel_" + entry.name;
+        if (parallel && !entry.sync_safe)
+        {
+            if (auto desync = dfa.find_newline_desync())
+            {
+                std::cerr << lexergen::warn_prefix()
+                          << std::format("[parallel] `{}`: not emitting {}: {} (add SYNC_SAFE to override)\n", fn_name, parallel_fn_name, desync->detail);
+                parallel_fn_name.clear();
+            }
+        }
+
+        auto incremental_fn_name =
+            !incremental ? std::string() : entry.name.empty() ? std::string("lex_incremental") : "lex_incremental_" + entry.name;
 
-        if (warn_unmatchable || warn_past_end)
+        if (warn_unmatchable || warn_past_end || warn_backtrack)
         {
-            auto diag = dfa.analyze_warnings(warn_unmatchable, warn_past_end);
+            auto diag = dfa.analyze_warnings(warn_unmatchable, warn_past_end, warn_backtrack);
             report_warnings(diag.unmatchable, fn_name, "unmatchable-token");
             report_warnings(diag.past_the_end, fn_name, "past-the-end");
+
+            for (const auto& pair : diag.quadratic)
+            {
+                const auto& accepted = entry.rule_lines[static_cast<std::size_t>(pair.accepted_rule)];
+                auto pursued = pair.pursued_rule == -1 ? std::string("a loop that matches nothing")
+                                                       : std::format("`{}`", entry.rule_lines[static_cast<std::size_t>(pair.pursued_rule)]);
+                std::string example;
+                for (int reps = 0; reps < 3 || example.size() < 8; reps++)
+                {
+                    example += pair.period;
+                }
+                std::cerr << lexergen::warn_prefix()
+                          << std::format(
+                                 "[quadratic-backtrack] `{}`: on an input like `{}…` (`{}` repeated), each `{}` token (state {}) is only found "
+                                 "after the scan for {} reads on to the end of the input and backtracks, so lexing takes quadratic time\n",
+                                 fn_name, example, pair.period, accepted, pair.state, pursued
+                             );
+            }
+            if (args["debug"].present)
+            {
+                for (const auto& bound : diag.rescan_bounds)
+                {
+                    std::cout << std::format(
+                        "[{}] state {} accepts rule {}: rescans {}\n", fn_name, bound.state, bound.rule,
+                        bound.max_bytes ? std::format("up to {} bytes", *bound.max_bytes) : std::string("without bound")
+                    );
+                }
+            }
         }
 
         if (args["debug"].present)
         {
             std::cout << std::format("[{}] start state: {}\n", fn_name, dfa.get_start_state());
             std::cout << std::format("[{}] states {}\n", fn_name, dfa.get_end_bitmask().size());
-            std::cout << std::format("[{}] emitted states: {}, emitted case labels: {}\n", fn_name, res.state_count, res.case_count);
+            if (linear)
+            {
+                std::cout << std::format("[{}] linear memo states: {}\n", fn_name, dfa.linear_memo_states().size());
+            }
         }
 
         names.push_back(entry.name.empty() ? base_fn_name : entry.name);
         dfas.push_back(std::move(dfa));
         nfas.push_back(std::move(nfa));
+
+        // the STATEs are emitted together once all of them are built
+        if (merge_states)
+        {
+            continue;
+        }
+
+        auto res = dfas.back().codegen(
+            out, preamble, entry.handle_error, entry.handle_internal_error,
+            {
+                .lang = lang,
+                .fn_name = fn_name,
+                .emit_prelude = i == 0,
+                .enable_simd = enable_simd,
+                .sentinel = sentinel,
+                .track_lines = track_lines,
+                .batch_fn_name = batch_fn_name,
+                .token_kinds = token_kinds,
+                .parallel_fn_name = parallel_fn_name,
+                .incremental_fn_name = incremental_fn_name,
+                .push_fn_name = push_fn_name,
+                .handle_need_more = entry.handle_need_more,
+                .stream_fn_name = stream_fn_name,
+                .linear = linear,
+            }
+        );
+
+        if (args["debug"].present)
+        {
+            std::cout << std::format("[{}] emitted states: {}, emitted case labels: {}\n", fn_name, res.state_count, res.case_count);
+        }
+    }
+
+    if (merge_states)
+    {
+        std::vector<lexergen::state_machine> machines;
+        for (std::size_t i = 0; i < dfas.size(); i++)
+        {
+            machines.push_back({
+                .name = state_names[i],
+                .machine = &dfas[i],
+                .handle_error = state_tables[i].handle_error,
+                .handle_internal_error = state_tables[i].handle_internal_error,
+            });
+        }
+
+        auto res = lexergen::dfa::codegen_states(
+            out, preamble, machines,
+            {
+                .lang = lang,
+                .fn_name = base_fn_name,
+                .enable_simd = enable_simd,
+                .sentinel = sentinel,
+                .track_lines = track_lines,
+                .token_kinds = token_kinds,
+                .state_actions = state_actions,
+            }
+        );
+
+        if (args["debug"].present)
+        {
+            std::cout << std::format("[{}] emitted states: {}, emitted case labels: {}\n", base_fn_name, res.state_count, res.case_count);
+        }
     }
 
     if (args["dfa-out"].present)
@@ -4,10 +4,15 @@
 #include "machine/interval_set.h"
 #include "machine/nfa.h"
 #include "machine/unicode_identifier_ranges.h"
+#include <algorithm>
+#include <array>
 #include <cctype>
 #include <cstdint>
+#include <map>
 #include <memory>
+#include <optional>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -39,6 +44,100 @@ namespace
         }
         return data;
     }
+
+    struct byte_range
+    {
+        uint8_t lo, hi;
+    };
+
+    // one UTF-8 byte-range sequence per entry, e.g. [E1-EC][80-BF][80-BF]; same split as RE2/utf8-ranges
+    auto utf8_sequences(const lexergen::char_set& charset) -> std::vector<std::vector<byte_range>>
+    {
+        using codepoint = lexergen::char_set::codepoint;
+        constexpr codepoint SURROGATE_LO = 0xD800;
+        constexpr codepoint SURROGATE_HI = 0xDFFF;
+        constexpr std::array<codepoint, 3> ENCODED_LENGTH_MAX = {0x7F, 0x7FF, 0xFFFF};
+
+        std::vector<std::pair<codepoint, codepoint>> todo;
+        for (const auto& iv : charset.get_intervals())
+        {
+            auto hi = std::min(iv.hi, lexergen::char_set::MAX_CODEPOINT);
+            if (iv.lo < SURROGATE_LO && hi >= SURROGATE_LO)
+            {
+                todo.emplace_back(iv.lo, SURROGATE_LO - 1);
+            }
+            if (iv.lo <= SURROGATE_HI && hi > SURROGATE_HI)
+            {
+                todo.emplace_back(SURROGATE_HI + 1, hi);
+            }
+            if (hi < SURROGATE_LO || iv.lo > SURROGATE_HI)
+            {
+                if (iv.lo <= hi)
+                {
+                    todo.emplace_back(iv.lo, hi);
+                }
+            }
+        }
+
+        std::vector<std::vector<byte_range>> result;
+        while (!todo.empty())
+        {
+            auto [lo, hi] = todo.back();
+            todo.pop_back();
+
+            // split until [lo, hi] shares an encoded length and all but its trailing bytes
+            bool split = true;
+            while (split)
+            {
+                split = false;
+                for (auto max : ENCODED_LENGTH_MAX)
+                {
+                    if (lo <= max && max < hi)
+                    {
+                        todo.emplace_back(max + 1, hi);
+                        hi = max;
+                        split = true;
+                        break;
+                    }
+                }
+                if (split || hi <= ENCODED_LENGTH_MAX[0])
+                {
+                    continue;
+                }
+                for (unsigned i = 1; i < 4 && !split; i++)
+                {
+                    codepoint mask = (codepoint{1} << (6 * i)) - 1;
+                    if ((lo & ~mask) == (hi & ~mask))
+                    {
+                        continue;
+                    }
+                    if ((lo & mask) != 0)
+                    {
+                        todo.emplace_back((lo | mask) + 1, hi);
+                        hi = lo | mask;
+                        split = true;
+                    }
+                    else if ((hi & mask) != mask)
+                    {
+                        todo.emplace_back(hi & ~mask, hi);
+                        hi = (hi & ~mask) - 1;
+                        split = true;
+                    }
+                }
+            }
+
+            auto lo_bytes = lexergen::utf8_encode(lo);
+            auto hi_bytes = lexergen::utf8_encode(hi);
+            std::vector<byte_range> seq;
+            for (size_t i = 0; i < lo_bytes.size(); i++)
+            {
+                seq.push_back({.lo = static_cast<uint8_t>(lo_bytes[i]), .hi = static_cast<uint8_t>(hi_bytes[i])});
+            }
+            result.push_back(std::move(seq));
+        }
+
+        return result;
+    }
 } // namespace
 
 auto lexergen::character(char ch) -> char_set { return char_set::single(static_cast<uint8_t>(ch)); }
@@ -64,11 +163,41 @@ auto lexergen::xdigit() -> char_set { return wrap_predicate<std::isxdigit>(); }
 auto lexergen::unicode_xid_start() -> char_set { return from_intervals(unicode::XID_START); }
 auto lexergen::unicode_xid_continue() -> char_set { return from_intervals(unicode::XID_CONTINUE); }
 
-auto lexergen::builtin_macros() -> macro_table
+auto lexergen::utf8_encode(char_set::codepoint cp) -> std::string
+{
+    std::string out;
+    if (cp < 0x80)
+    {
+        out += static_cast<char>(cp);
+    }
+    else if (cp < 0x800)
+    {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+auto lexergen::builtin_macros(const regex_options& options) -> macro_table
 {
+    auto charset_regex = [&](const char_set& charset) -> regex { return options.utf8 ? utf8_regex(charset) : char_regex(charset); };
+
     macro_table macros;
-    macros["XID_Start"] = char_regex(unicode_xid_start());
-    macros["XID_Continue"] = char_regex(unicode_xid_continue());
+    macros["XID_Start"] = charset_regex(unicode_xid_start());
+    macros["XID_Continue"] = charset_regex(unicode_xid_continue());
     return macros;
 }
 
@@ -97,11 +226,98 @@ auto lexergen::char_regex(char_set charset) -> regex
         }
 
         void collect_charsets(std::vector<interval_set>& out) const override { out.push_back(charset); }
+
+        auto fixed_length(bool byte_level) const -> std::optional<int64_t> override
+        {
+            const auto& ivs = charset.get_intervals();
+            if (ivs.empty() || (!byte_level && ivs.back().hi >= 0x80))
+            {
+                return std::nullopt;
+            }
+            return 1;
+        }
     };
 
     return std::make_shared<ch_regex>(std::move(charset));
 }
 
+auto lexergen::utf8_regex(const char_set& charset) -> regex
+{
+    struct utf8_set_regex : public detail::regex_element
+    {
+        std::vector<std::vector<byte_range>> sequences;
+        explicit utf8_set_regex(std::vector<std::vector<byte_range>> sequences) : sequences(std::move(sequences)) {}
+
+        auto generate(nfa_builder& builder, int64_t& node_alloc, const equivalence_classes& classes) const -> std::pair<int64_t, int64_t> override
+        {
+            auto start = node_alloc++;
+            auto end = node_alloc++;
+
+            // sequences sharing leading byte ranges share NFA nodes, so the DFA doesn't blow up per sequence
+            std::map<std::tuple<int64_t, uint8_t, uint8_t>, int64_t> trie;
+            for (const auto& seq : sequences)
+            {
+                int64_t curr = start;
+                for (size_t i = 0; i < seq.size(); i++)
+                {
+                    int64_t next = end;
+                    if (i + 1 < seq.size())
+                    {
+                        auto [it, inserted] = trie.try_emplace({curr, seq[i].lo, seq[i].hi}, 0);
+                        if (inserted)
+                        {
+                            it->second = node_alloc++;
+                        }
+                        else
+                        {
+                            curr = it->second;
+                            continue;
+                        }
+                        next = it->second;
+                    }
+
+                    auto [first_class, last_class] = classes.class_range_for(seq[i].lo, seq[i].hi);
+                    for (auto class_id = first_class; class_id <= last_class; class_id++)
+                    {
+                        builder.transition(curr, next, class_id);
+                    }
+                    curr = next;
+                }
+            }
+
+            return {start, end};
+        }
+
+        void collect_charsets(std::vector<interval_set>& out) const override
+        {
+            for (const auto& seq : sequences)
+            {
+                for (const auto& range : seq)
+                {
+                    out.push_back(interval_set::range(range.lo, range.hi));
+                }
+            }
+        }
+
+        auto fixed_length(bool byte_level) const -> std::optional<int64_t> override
+        {
+            (void)byte_level; // already bytes
+            if (sequences.empty() || std::ranges::any_of(sequences, [&](const auto& seq) { return seq.size() != sequences[0].size(); }))
+            {
+                return std::nullopt;
+            }
+            return static_cast<int64_t>(sequences[0].size());
+        }
+    };
+
+    // ASCII-only sets encode as themselves
+    if (charset.get_intervals().empty() || charset.get_intervals().back().hi < 0x80)
+    {
+        return char_regex(charset);
+    }
+    return std::make_shared<utf8_set_regex>(utf8_sequences(charset));
+}
+
 auto lexergen::string_regex(std::string str) -> regex
 {
     struct str_regex : public detail::regex_element
@@ -132,6 +348,15 @@ auto lexergen::string_regex(std::string str) -> regex
                 out.push_back(interval_set::single(static_cast<uint8_t>(ch)));
             }
         }
+
+        auto fixed_length(bool byte_level) const -> std::optional<int64_t> override
+        {
+            if (!byte_level && std::ranges::any_of(str, [](char ch) { return static_cast<uint8_t>(ch) >= 0x80; }))
+            {
+                return std::nullopt;
+            }
+            return static_cast<int64_t>(str.size());
+        }
     };
 
     return std::make_shared<str_regex>(std::move(str));
@@ -183,6 +408,17 @@ auto lexergen::operator+(const regex& lhs, const regex& rhs) -> regex
             lhs->collect_charsets(out);
             rhs->collect_charsets(out);
         }
+
+        auto fixed_length(bool byte_level) const -> std::optional<int64_t> override
+        {
+            auto left = lhs->fixed_length(byte_level);
+            auto right = rhs->fixed_length(byte_level);
+            if (!left || !right)
+            {
+                return std::nullopt;
+            }
+            return *left + *right;
+        }
     };
 
     return std::make_shared<plus_regex>(lhs, rhs);
@@ -244,6 +480,12 @@ auto lexergen::operator|(const regex& lhs, const regex& rhs) -> regex
             lhs->collect_charsets(out);
             rhs->collect_charsets(out);
         }
+
+        auto fixed_length(bool byte_level) const -> std::optional<int64_t> override
+        {
+            auto left = lhs->fixed_length(byte_level);
+            return left == rhs->fixed_length(byte_level) ? left : std::nullopt;
+        }
     };
 
     return std::make_shared<or_regex>(lhs, rhs);
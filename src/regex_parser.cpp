@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <utility>
 
 #define YIELD_TOK(sw, t)                                                                                                                             \
@@ -65,9 +66,35 @@ namespace
     {
         const std::string& str;
         const macro_table& macros;
+        const regex_options& options;
         size_t index{};
         tok curr_token{};
 
+        // raw UTF-8 in the pattern becomes one codepoint token; anything malformed stays a plain byte
+        auto lex_utf8(char lead) -> tok
+        {
+            auto byte = static_cast<uint8_t>(lead);
+            size_t len = byte >= 0xF0 ? 4 : byte >= 0xE0 ? 3 : byte >= 0xC0 ? 2 : 0;
+            if (len == 0 || byte > 0xF4 || index + len - 1 > str.size())
+            {
+                return {.ch = lead, .type = tok::TOK_CHAR};
+            }
+
+            uint32_t val = byte & (0x7F >> len);
+            for (size_t i = 0; i < len - 1; i++)
+            {
+                auto cont = static_cast<uint8_t>(str[index + i]);
+                if ((cont & 0xC0) != 0x80)
+                {
+                    return {.ch = lead, .type = tok::TOK_CHAR};
+                }
+                val = (val << 6) | (cont & 0x3F);
+            }
+
+            index += len - 1;
+            return {.ch = 0, .codepoint = val, .type = tok::TOK_CODEPOINT};
+        }
+
         auto lex_tok() -> tok
         {
 
@@ -169,12 +196,30 @@ namespace
                 YIELD_TOK('-', tok::TOK_DASH);
                 YIELD_TOK('/', tok::TOK_DELIM);
             default:
+                if (options.utf8 && static_cast<uint8_t>(ch) >= 0x80)
+                {
+                    return lex_utf8(ch);
+                }
                 return {.ch = ch, .type = tok::TOK_CHAR};
             }
         }
 
     public:
-        regex_reader(const std::string& str, const macro_table& macros) : str(str), macros(macros) { next(); }
+        regex_reader(const std::string& str, const macro_table& macros, const regex_options& options) : str(str), macros(macros), options(options)
+        {
+            next();
+        }
+
+        // in utf8 mode charsets range over all of Unicode rather than bytes
+        [[nodiscard]] auto negate(const char_set& charset) const -> char_set
+        {
+            return options.utf8 ? charset.complement(char_set::MAX_CODEPOINT) : ~charset;
+        }
+
+        [[nodiscard]] auto charset_regex(const char_set& charset) const -> regex
+        {
+            return options.utf8 ? utf8_regex(charset) : char_regex(charset);
+        }
 
         auto lookup_macro(const std::string& name) -> regex
         {
@@ -210,6 +255,11 @@ namespace
 
         [[nodiscard]] auto has() const -> bool { return curr_token.type != tok::TOK_EOF; }
 
+        // where the reader is, to come back to with rewind() after a speculative parse
+        [[nodiscard]] auto position() const -> std::pair<size_t, tok> { return {index, curr_token}; }
+
+        void rewind(const std::pair<size_t, tok>& pos) { std::tie(index, curr_token) = pos; }
+
         template <typename... Args>
         auto match(Args... args)
         {
@@ -266,11 +316,11 @@ namespace
                     break;
                 });
                 _case(tok::TOK_CHARSET_ALPHA, new_chars = alphanumeric());
-                _case(tok::TOK_CHARSET_NOT_ALPHA, new_chars = ~alphanumeric());
+                _case(tok::TOK_CHARSET_NOT_ALPHA, new_chars = reader.negate(alphanumeric()));
                 _case(tok::TOK_CHARSET_DIGIT, new_chars = digit());
-                _case(tok::TOK_CHARSET_NOT_DIGIT, new_chars = ~digit());
+                _case(tok::TOK_CHARSET_NOT_DIGIT, new_chars = reader.negate(digit()));
                 _case(tok::TOK_CHARSET_WHITESPACE, new_chars = whitespace());
-                _case(tok::TOK_CHARSET_NOT_WHITESPACE, new_chars = ~whitespace());
+                _case(tok::TOK_CHARSET_NOT_WHITESPACE, new_chars = reader.negate(whitespace()));
             default:
                 new_chars = tok_charset(token);
             }
@@ -278,7 +328,7 @@ namespace
             current_charset = current_charset | new_chars;
         }
 
-        return char_regex(negate ? ~current_charset : current_charset);
+        return reader.charset_regex(negate ? reader.negate(current_charset) : current_charset);
     }
 
     auto parse_atom(regex_reader& reader) -> regex;
@@ -437,6 +487,11 @@ namespace
         tok token{};
         while ((token = reader.next()).type != tok::TOK_STR)
         {
+            if (token.type == tok::TOK_CODEPOINT && reader.options.utf8)
+            {
+                str += utf8_encode(token.codepoint);
+                continue;
+            }
             str += token.ch;
         }
 
@@ -472,26 +527,28 @@ namespace
         {
             _case(tok::TOK_CHAR_OPEN, return parse_char_class(reader));
             _case(tok::TOK_CHARSET_ALPHA, return char_regex(alphanumeric()));
-            _case(tok::TOK_CHARSET_NOT_ALPHA, return char_regex(~alphanumeric()));
+            _case(tok::TOK_CHARSET_NOT_ALPHA, return reader.charset_regex(reader.negate(alphanumeric())));
             _case(tok::TOK_CHARSET_DIGIT, return char_regex(digit()));
-            _case(tok::TOK_CHARSET_NOT_DIGIT, return char_regex(~digit()));
+            _case(tok::TOK_CHARSET_NOT_DIGIT, return reader.charset_regex(reader.negate(digit())));
             _case(tok::TOK_CHARSET_WHITESPACE, return char_regex(whitespace()));
-            _case(tok::TOK_CHARSET_NOT_WHITESPACE, return char_regex(~whitespace()));
+            _case(tok::TOK_CHARSET_NOT_WHITESPACE, return reader.charset_regex(reader.negate(whitespace())));
             _case(tok::TOK_GROUP_OPEN, return parse_group(reader));
-            _case(tok::TOK_WILDCARD, return char_regex(~empty()));
+            _case(tok::TOK_WILDCARD, return reader.charset_regex(reader.negate(empty())));
             _case(tok::TOK_STR, return parse_string(reader));
-            _case(tok::TOK_CODEPOINT, return char_regex(char_set::single(token.codepoint)));
+            _case(tok::TOK_CODEPOINT, return reader.charset_regex(char_set::single(token.codepoint)));
         default:
-            return char_regex(token.ch);
+            return reader.charset_regex(tok_charset(token));
         }
     }
 
-    auto parse(regex_reader& reader)
+    // `/r/s/` is r with trailing context s, when s parses up to a closing `/` followed by whitespace or the end. Anything else after
+    // r's closing `/` is left for the handler, as in `/a/{ return 1; }`.
+    auto parse(regex_reader& reader) -> std::pair<regex, regex>
     {
         if (reader.match(tok::TOK_STR))
         {
             reader.next();
-            return parse_string(reader);
+            return {parse_string(reader), nullptr};
         }
 
         if (!reader.match_advance(tok::TOK_DELIM))
@@ -506,19 +563,41 @@ namespace
             throw regex_parse_error("expected / at the end of regex");
         }
 
-        return res;
+        auto at_end = [&]
+        { return !reader.has() || (reader.curr().type == tok::TOK_CHAR && std::isspace(static_cast<unsigned char>(reader.curr().ch)) != 0); };
+        if (at_end())
+        {
+            return {res, nullptr};
+        }
+
+        auto after_expr = reader.position();
+        try
+        {
+            auto trailing = parse_alt(reader);
+            if (reader.match_advance(tok::TOK_DELIM) && at_end())
+            {
+                return {res, trailing};
+            }
+        }
+        catch (const regex_parse_error&)
+        {
+        }
+        reader.rewind(after_expr);
+        return {res, nullptr};
     }
 } // namespace
 
-auto lexergen::parse_regex(const std::string& str, const macro_table& macros) -> regex_parse_result
+auto lexergen::parse_regex(const std::string& str, const macro_table& macros, const regex_options& options) -> regex_parse_result
 {
-    regex_reader reader(str, macros);
+    regex_reader reader(str, macros, options);
 
     try
     {
+        auto [expr, trailing] = parse(reader);
         return {
             .is_success = true,
-            .expr = parse(reader),
+            .expr = expr,
+            .trailing = trailing,
             .rest = reader.get_remaining(),
         };
     }
@@ -0,0 +1,29 @@
+#!/usr/bin/env python3
+
+# Usage: expect_quadratic.py <lexer-gen> <grammar> [period]
+# Runs -Wquadratic-backtrack on the grammar. With a period, passes if some warning gives it as the repeated part of its example
+# input; without one, passes if there is no warning.
+
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def main():
+    lexer_gen, grammar = sys.argv[1], sys.argv[2]
+    period = sys.argv[3] if len(sys.argv) > 3 else None
+    with tempfile.TemporaryDirectory() as out:
+        run = subprocess.run([lexer_gen, "-Wquadratic-backtrack", grammar, "-o", os.path.join(out, "lexer.cpp")],
+                             capture_output=True, text=True)
+    sys.stderr.write(run.stderr)
+    if run.returncode != 0:
+        return 1
+    warnings = [line for line in run.stderr.splitlines() if "[quadratic-backtrack]" in line]
+    if period is None:
+        return 1 if warnings else 0
+    return 0 if any(f"(`{period}` repeated)" in line for line in warnings) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())